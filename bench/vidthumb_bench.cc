@@ -0,0 +1,428 @@
+// Microbenchmarks of the frame kernels, the scaling done for analysis and
+// thumbnails, and reading images from zip files. Every case runs until the
+// minimum time has passed, a few times over, and the fastest run is reported
+// in nanoseconds per pixel of its input and in frames per second.
+//
+//   vidthumb_bench [-t seconds] [-r repetitions] [filter]
+
+#include "frame.hh"
+#include "image_decoder.hh"
+#include "image_writer.hh"
+#include "zip_stream.hh"
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace vidthumb;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// seconds each run lasts at least, runs per case, and the cases to run
+double          MinTime     = 0.25;
+size_t          Repetitions = 5;
+const char*     pFilter     = nullptr;
+
+// results of the kernels end up here, so they can't be optimised away
+volatile float  Sink;
+
+bool IsSelected(const char* pName)
+{
+    return !pFilter || strstr(pName, pFilter);
+}
+
+// fastest time of one call in seconds, after a call to warm up the buffers
+template<typename Body>
+double Measure(Body body)
+{
+    body();
+
+    double best = HUGE_VAL;
+    for (size_t run=0; run<Repetitions; run++) {
+        Clock::time_point start = Clock::now();
+        size_t calls = 0;
+        double elapsed;
+        do {
+            body();
+            calls++;
+            elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        } while (elapsed < MinTime);
+
+        best = std::min(best, elapsed / calls);
+    }
+    return best;
+}
+
+void Report(const char* pName, size_t width, size_t height, double seconds)
+{
+    printf("%-24s %5zux%-5zu %10.3f ns/px %12.1f frames/s\n", pName, width, height, seconds * 1e9 / (width * height), 1.0 / seconds);
+    fflush(stdout);
+}
+
+// a gradient with some noise, the same on every run
+void FillPixels(uint8_t* pData, size_t rowBytes, size_t height, size_t stride, uint32_t seed)
+{
+    std::minstd_rand random(seed);
+    for (size_t y=0; y<height; y++) {
+        for (size_t x=0; x<rowBytes; x++)
+            pData[y*stride + x] = (x + 2*y + random() % 24) & 0xff;
+    }
+}
+
+void FillFrame(Frame& frame, uint32_t seed)
+{
+    FillPixels(frame.GetData(), frame.GetWidth() * frame.GetBytesPerPixel(), frame.GetHeight(), frame.GetStride(), seed);
+}
+
+void BenchKernels()
+{
+    static const size_t sizes[][2] = { { 64, 36 }, { 160, 90 }, { 320, 180 }, { 640, 360 }, { 1920, 1080 } };
+
+    for (PixelFormat format : { PixelFormat::Gray, PixelFormat::RGB }) {
+        const char* pDifference = format == PixelFormat::Gray ? "difference gray" : "difference rgb";
+        const char* pContrast   = format == PixelFormat::Gray ? "contrast gray"   : "contrast rgb";
+
+        for (auto& size : sizes) {
+            Frame a(size[0], size[1], format), b(size[0], size[1], format);
+            FillFrame(a, 1);
+            FillFrame(b, 2);
+
+            if (IsSelected(pDifference))
+                Report(pDifference, size[0], size[1], Measure([&]() { Sink = a.GetDifference(&b); }));
+            if (IsSelected(pContrast))
+                Report(pContrast, size[0], size[1], Measure([&]() { Sink = a.GetContrast(); }));
+        }
+    }
+}
+
+void BenchFrameCopies()
+{
+    static const size_t sizes[][2] = { { 64, 36 }, { 320, 200 }, { 1280, 720 }, { 1920, 1080 } };
+
+    for (auto& size : sizes) {
+        Frame source(size[0], size[1]);
+        FillFrame(source, 3);
+
+        // a new frame every time, which the buffer pool should make cheap
+        if (IsSelected("copy construct")) {
+            Report("copy construct", size[0], size[1], Measure([&]() {
+                Frame copy(source);
+                Sink = copy.GetData()[0];
+            }));
+        }
+
+        // into a frame of the same size, reusing its buffer
+        if (IsSelected("copy assign")) {
+            Frame target(size[0], size[1]);
+            Report("copy assign", size[0], size[1], Measure([&]() {
+                target = source;
+                Sink = target.GetData()[0];
+            }));
+        }
+
+        if (IsSelected("move")) {
+            Frame a(source), b;
+            Report("move", size[0], size[1], Measure([&]() {
+                b = std::move(a);
+                a = std::move(b);
+            }));
+        }
+    }
+}
+
+void BenchScaling()
+{
+    static const size_t sizes[][2] = { { 640, 360 }, { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+
+    for (auto& size : sizes) {
+        size_t width  = size[0];
+        size_t height = size[1];
+
+        // a decoded YUV 4:2:0 frame
+        std::vector<uint8_t> luma(width * height), chromaU(width * height / 4), chromaV(width * height / 4);
+        FillPixels(luma.data(), width, height, width, 4);
+        FillPixels(chromaU.data(), width / 2, height / 2, width / 2, 5);
+        FillPixels(chromaV.data(), width / 2, height / 2, width / 2, 6);
+
+        const uint8_t* sourceData[4]     = { luma.data(), chromaU.data(), chromaV.data(), nullptr };
+        int            sourceLineSize[4] = { (int)width, (int)width / 2, (int)width / 2, 0 };
+
+        // the same sizes, formats and filters the streams use
+        size_t analysisWidth, analysisHeight, thumbWidth, thumbHeight;
+        FitIntoBox(width, height, 64, 36, analysisWidth, analysisHeight);
+        FitIntoBox(width, height, 320, 200, thumbWidth, thumbHeight);
+
+        Frame analysis(analysisWidth, analysisHeight, PixelFormat::Gray);
+        Frame thumb(thumbWidth, thumbHeight);
+
+        struct Case
+        {
+            const char*     pName;
+            AVPixelFormat   sourceFormat;
+            Frame*          pTarget;
+            AVPixelFormat   targetFormat;
+            int             flags;
+        };
+
+        Case cases[] = {
+            { "scale lq luma", AV_PIX_FMT_GRAY8,   &analysis, AV_PIX_FMT_GRAY8, SWS_AREA },
+            { "scale lq yuv",  AV_PIX_FMT_YUV420P, &analysis, AV_PIX_FMT_GRAY8, SWS_AREA },
+            { "scale hq",      AV_PIX_FMT_YUV420P, &thumb,    AV_PIX_FMT_RGB32, SWS_LANCZOS },
+        };
+
+        for (auto& scaleCase : cases) {
+            if (!IsSelected(scaleCase.pName))
+                continue;
+
+            Frame&      target  = *scaleCase.pTarget;
+            SwsContext* pContext = sws_getContext(width, height, scaleCase.sourceFormat, target.GetWidth(), target.GetHeight(), scaleCase.targetFormat, scaleCase.flags, nullptr, nullptr, nullptr);
+            if (!pContext) {
+                fprintf(stderr, "Could not create scaler for %s.\n", scaleCase.pName);
+                continue;
+            }
+
+            uint8_t* targetData[4]     = { target.GetData(), nullptr, nullptr, nullptr };
+            int      targetLineSize[4] = { (int)target.GetStride(), 0, 0, 0 };
+
+            Report(scaleCase.pName, width, height, Measure([&]() {
+                sws_scale(pContext, sourceData, sourceLineSize, 0, height, targetData, targetLineSize);
+            }));
+
+            sws_freeContext(pContext);
+        }
+    }
+}
+
+void Put16(std::vector<uint8_t>& data, uint16_t value)
+{
+    data.push_back(value);
+    data.push_back(value >> 8);
+}
+
+void Put32(std::vector<uint8_t>& data, uint32_t value)
+{
+    Put16(data, value);
+    Put16(data, value >> 16);
+}
+
+// a zip file of the given images, stored or deflated
+std::vector<uint8_t> CreateZip(const std::vector<std::vector<uint8_t>>& images, bool deflated)
+{
+    std::vector<uint8_t> archive, directory;
+
+    for (size_t i=0; i<images.size(); i++) {
+        const std::vector<uint8_t>& image = images[i];
+
+        std::vector<uint8_t> compressed = image;
+        if (deflated) {
+            z_stream stream;
+            memset(&stream, 0, sizeof(stream));
+            deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+            compressed.resize(deflateBound(&stream, image.size()));
+            stream.next_in   = (Bytef*)image.data();
+            stream.avail_in  = image.size();
+            stream.next_out  = compressed.data();
+            stream.avail_out = compressed.size();
+            deflate(&stream, Z_FINISH);
+            compressed.resize(stream.total_out);
+            deflateEnd(&stream);
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "image%04zu.jpg", i);
+        uint32_t checksum = crc32(0, image.data(), image.size());
+        uint32_t offset   = archive.size();
+
+        Put32(archive, 0x04034b50);
+        Put16(archive, 20);
+        Put16(archive, 0);
+        Put16(archive, deflated ? 8 : 0);
+        Put32(archive, 0);
+        Put32(archive, checksum);
+        Put32(archive, compressed.size());
+        Put32(archive, image.size());
+        Put16(archive, strlen(name));
+        Put16(archive, 0);
+        archive.insert(archive.end(), name, name + strlen(name));
+        archive.insert(archive.end(), compressed.begin(), compressed.end());
+
+        Put32(directory, 0x02014b50);
+        Put16(directory, 20);
+        Put16(directory, 20);
+        Put16(directory, 0);
+        Put16(directory, deflated ? 8 : 0);
+        Put32(directory, 0);
+        Put32(directory, checksum);
+        Put32(directory, compressed.size());
+        Put32(directory, image.size());
+        Put16(directory, strlen(name));
+        Put32(directory, 0);
+        Put32(directory, 0);
+        Put32(directory, 0);
+        Put32(directory, offset);
+        directory.insert(directory.end(), name, name + strlen(name));
+    }
+
+    uint32_t directoryOffset = archive.size();
+    archive.insert(archive.end(), directory.begin(), directory.end());
+
+    Put32(archive, 0x06054b50);
+    Put32(archive, 0);
+    Put16(archive, images.size());
+    Put16(archive, images.size());
+    Put32(archive, directory.size());
+    Put32(archive, directoryOffset);
+    Put16(archive, 0);
+    return archive;
+}
+
+std::vector<uint8_t> EncodeJPEG(const Frame& frame)
+{
+    std::vector<uint8_t> image;
+
+    char*  pData = nullptr;
+    size_t size  = 0;
+    FILE*  pFile = open_memstream(&pData, &size);
+    if (!pFile)
+        return image;
+
+    ImageWriterOptions options;
+    options.format = "jpeg";
+
+    ImageWriter* pWriter = ImageWriter::Create(pFile, options);
+    bool success = pWriter && pWriter->Begin(frame.GetWidth(), frame.GetHeight())
+        && pWriter->WriteRows(frame.GetData(), frame.GetHeight(), frame.GetStride()) && pWriter->End();
+    delete pWriter;
+
+    success = fclose(pFile) == 0 && success;
+    if (success)
+        image.assign(pData, pData + size);
+    free(pData);
+    return image;
+}
+
+// exposes the loading of single entries
+class BenchZipStream : public ZipStream
+{
+public:
+
+                        BenchZipStream() : ZipStream(320, 200) {}
+
+    using ZipStream::Open;
+
+    bool                LoadEntry(size_t entry)
+    {
+        const uint8_t* pImage;
+        return this->LoadImage(this->Entries[entry], this->InflateBuffer, pImage);
+    }
+
+    size_t              GetEntryCount() const { return this->Entries.size(); }
+
+private:
+
+    std::vector<uint8_t> InflateBuffer;
+};
+
+void BenchZip()
+{
+    static const size_t sizes[][2] = { { 640, 360 }, { 1920, 1080 }, { 3840, 2160 } };
+    static const size_t imageCount = 8;
+
+    for (auto& size : sizes) {
+        size_t width  = size[0];
+        size_t height = size[1];
+
+        std::vector<std::vector<uint8_t>> images;
+        for (size_t i=0; i<imageCount; i++) {
+            Frame frame(width, height);
+            FillFrame(frame, 7 + i);
+            images.push_back(EncodeJPEG(frame));
+            if (images.back().empty()) {
+                fprintf(stderr, "Could not encode test image.\n");
+                return;
+            }
+        }
+
+        for (bool deflated : { false, true }) {
+            std::vector<uint8_t> archive = CreateZip(images, deflated);
+
+            BenchZipStream stream;
+            if (!stream.Open(StreamInput::FromMemory(archive.data(), archive.size()))) {
+                fprintf(stderr, "Could not open test archive.\n");
+                return;
+            }
+
+            size_t entry = 0;
+            const char* pLoad = deflated ? "zip load deflated" : "zip load stored";
+            if (IsSelected(pLoad)) {
+                Report(pLoad, width, height, Measure([&]() {
+                    Sink = stream.LoadEntry(entry);
+                    entry = (entry + 1) % stream.GetEntryCount();
+                }));
+            }
+
+            // the whole way to a frame, decoding included
+            for (bool highQuality : { false, true }) {
+                const char* pName = deflated ? (highQuality ? "zip hq frame deflated" : "zip lq frame deflated")
+                                            : (highQuality ? "zip hq frame stored"   : "zip lq frame stored");
+                if (!IsSelected(pName))
+                    continue;
+
+                Frame frame;
+                stream.Rewind();
+                Report(pName, width, height, Measure([&]() {
+                    if (!stream.GetNextFrame(frame, highQuality)) {
+                        stream.Rewind();
+                        stream.GetNextFrame(frame, highQuality);
+                    }
+                }));
+            }
+        }
+    }
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    while (argc > 1 && argv[1][0] == '-') {
+        if (!::strcmp(argv[1], "-t") && argc > 2) {
+            MinTime = ::strtod(argv[2], nullptr);
+            argc--;
+            argv++;
+        } else if (!::strcmp(argv[1], "-r") && argc > 2) {
+            Repetitions = std::max<size_t>(1, ::strtoul(argv[2], nullptr, 10));
+            argc--;
+            argv++;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[1]);
+            return -1;
+        }
+        argc--;
+        argv++;
+    }
+
+    if (argc > 1)
+        pFilter = argv[1];
+
+    BenchKernels();
+    BenchFrameCopies();
+    BenchScaling();
+    BenchZip();
+    return 0;
+}
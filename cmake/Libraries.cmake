@@ -2,12 +2,29 @@
 FIND_PACKAGE( FFMPEG REQUIRED )
 FIND_PACKAGE( Cairo  REQUIRED )
 FIND_PACKAGE( DevIL  REQUIRED )
+FIND_PACKAGE( JPEG   REQUIRED )
+FIND_PACKAGE( PNG    REQUIRED )
+FIND_PACKAGE( Threads REQUIRED )
 FIND_LIBRARY( ZLIB_LIBRARY NAMES libz.a z zlib )
 
+# WebP output is optional
+FIND_PATH( WEBP_INCLUDE_DIR webp/encode.h )
+FIND_LIBRARY( WEBP_LIBRARY NAMES webp )
+IF( WEBP_INCLUDE_DIR AND WEBP_LIBRARY )
+  ADD_DEFINITIONS( -DHAVE_WEBP )
+  INCLUDE_DIRECTORIES( ${WEBP_INCLUDE_DIR} )
+ELSE( )
+  SET( WEBP_LIBRARY "" )
+ENDIF( )
+
 SET( LIBRARIES 
   ${FFMPEG_LIBRARIES}
   ${CAIRO_LIBRARIES}
   ${IL_LIBRARIES}
   ${ILU_LIBRARIES}
+  ${JPEG_LIBRARIES}
+  ${PNG_LIBRARIES}
+  ${WEBP_LIBRARY}
   ${ZLIB_LIBRARY}
+  ${CMAKE_THREAD_LIBS_INIT}
 )
\ No newline at end of file
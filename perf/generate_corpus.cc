@@ -0,0 +1,424 @@
+// Writes the synthetic inputs of the throughput tests into a directory: clips
+// of a few codecs, resolutions and GOP lengths, and zip files of stored and
+// deflated images. Inputs that are already there are kept, and corpus.txt
+// lists all of them with their frame counts. Clips whose encoder ffmpeg was
+// built without are left out.
+//
+//   vidthumb_corpus directory
+
+#include "frame.hh"
+#include "image_writer.hh"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/opt.h>
+}
+
+#include <zlib.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+using namespace vidthumb;
+
+namespace {
+
+static const int    FrameRate   = 25;
+
+// frames between cuts, so the overview has something to pick
+static const size_t SceneLength = 40;
+
+struct ClipSpec
+{
+    const char*         pCodec;
+    const char*         pExtension;
+    size_t              width;
+    size_t              height;
+    int                 gopSize;
+    size_t              frameCount;
+};
+
+static const ClipSpec Clips[] = {
+    { "mpeg4",   "mp4", 320,  240,  12,  750 },
+    { "mpeg4",   "mp4", 1280, 720,  250, 500 },
+    { "mpeg4",   "mkv", 1920, 1080, 12,  250 },
+    { "libx264", "mp4", 1280, 720,  250, 500 },
+    { "libx264", "mkv", 1920, 1080, 50,  250 },
+    { "mjpeg",   "avi", 1280, 720,  1,   250 },
+};
+
+struct ArchiveSpec
+{
+    const char*         pFormat;
+    bool                deflated;
+    size_t              width;
+    size_t              height;
+    size_t              imageCount;
+};
+
+static const ArchiveSpec Archives[] = {
+    { "jpeg", false, 1920, 1080, 60 },
+    { "jpeg", true,  1920, 1080, 60 },
+    { "png",  false, 1280, 720,  30 },
+};
+
+bool FileExists(const std::string& fileName)
+{
+    struct stat fileStat;
+    return stat(fileName.c_str(), &fileStat) == 0 && S_ISREG(fileStat.st_mode);
+}
+
+// moving stripes and a moving block, a different look for every scene and a
+// little noise, the same on every run
+uint8_t GetPixel(size_t x, size_t y, size_t index, int channel, std::minstd_rand& random)
+{
+    size_t scene = index / SceneLength;
+    size_t t     = index % SceneLength;
+    size_t block = (t * 8 + scene * 97) % 512;
+
+    if (x >= block && x < block + 96 && y >= block / 2 && y < block / 2 + 96)
+        return 235 - channel * 40;
+
+    return (((x + scene * 13) * (1 + scene % 3) + y * (channel + 1) + t * 3 + scene * 61 * (channel + 1)) & 0x7f) + 32 + random() % 8;
+}
+
+void FillYUV(AVFrame* pFrame, size_t index)
+{
+    std::minstd_rand random(index + 1);
+    for (int y=0; y<pFrame->height; y++) {
+        for (int x=0; x<pFrame->width; x++)
+            pFrame->data[0][y * pFrame->linesize[0] + x] = GetPixel(x, y, index, 0, random);
+    }
+
+    for (int plane=1; plane<3; plane++) {
+        for (int y=0; y<pFrame->height / 2; y++) {
+            for (int x=0; x<pFrame->width / 2; x++)
+                pFrame->data[plane][y * pFrame->linesize[plane] + x] = GetPixel(x * 2, y * 2, index, plane, random);
+        }
+    }
+}
+
+void FillRGB(Frame& frame, size_t index)
+{
+    std::minstd_rand random(index + 1);
+    for (size_t y=0; y<frame.GetHeight(); y++) {
+        uint8_t* pRow = frame.GetData() + y * frame.GetStride();
+        for (size_t x=0; x<frame.GetWidth(); x++) {
+            uint32_t pixel = GetPixel(x, y, index, 0, random) << 16 | GetPixel(x, y, index, 1, random) << 8 | GetPixel(x, y, index, 2, random);
+            ::memcpy(pRow + x * 4, &pixel, 4);
+        }
+    }
+}
+
+// send a frame, or nullptr to flush, and write what comes out
+bool EncodeFrame(AVFormatContext* pFormat, AVStream* pStream, AVCodecContext* pContext, AVFrame* pFrame, AVPacket* pPacket)
+{
+    if (avcodec_send_frame(pContext, pFrame) < 0)
+        return false;
+
+    for (;;) {
+        int result = avcodec_receive_packet(pContext, pPacket);
+        if (result == AVERROR(EAGAIN) || result == AVERROR_EOF)
+            return true;
+        if (result < 0)
+            return false;
+
+        av_packet_rescale_ts(pPacket, pContext->time_base, pStream->time_base);
+        pPacket->stream_index = pStream->index;
+        if (av_interleaved_write_frame(pFormat, pPacket) < 0)
+            return false;
+    }
+}
+
+bool WriteClip(const ClipSpec& clip, const std::string& fileName)
+{
+    AVCodec* pCodec = avcodec_find_encoder_by_name(clip.pCodec);
+    if (!pCodec) {
+        fprintf(stderr, "No %s encoder, leaving out %s.\n", clip.pCodec, fileName.c_str());
+        return false;
+    }
+
+    AVFormatContext* pFormat  = nullptr;
+    AVCodecContext*  pContext = nullptr;
+    AVFrame*         pFrame   = av_frame_alloc();
+    AVPacket*        pPacket  = av_packet_alloc();
+    AVStream*        pStream  = nullptr;
+    bool             success  = false;
+
+    if (avformat_alloc_output_context2(&pFormat, nullptr, nullptr, fileName.c_str()) >= 0 && pFrame && pPacket) {
+        pStream  = avformat_new_stream(pFormat, nullptr);
+        pContext = avcodec_alloc_context3(pCodec);
+    }
+
+    if (pStream && pContext) {
+        pContext->width         = clip.width;
+        pContext->height        = clip.height;
+        pContext->pix_fmt       = pCodec->id == AV_CODEC_ID_MJPEG ? AV_PIX_FMT_YUVJ420P : AV_PIX_FMT_YUV420P;
+        pContext->time_base     = AVRational { 1, FrameRate };
+        pContext->framerate     = AVRational { FrameRate, 1 };
+        pContext->gop_size      = clip.gopSize;
+        pContext->max_b_frames  = 0;
+        pContext->bit_rate      = clip.width * clip.height * FrameRate / 8;
+        pContext->thread_count  = 0;
+
+        if (pFormat->oformat->flags & AVFMT_GLOBALHEADER)
+            pContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+        if (pCodec->id == AV_CODEC_ID_H264)
+            av_opt_set(pContext->priv_data, "preset", "veryfast", 0);
+
+        pFrame->format = pContext->pix_fmt;
+        pFrame->width  = clip.width;
+        pFrame->height = clip.height;
+
+        success = avcodec_open2(pContext, pCodec, nullptr) == 0
+            && avcodec_parameters_from_context(pStream->codecpar, pContext) >= 0
+            && av_frame_get_buffer(pFrame, 32) == 0
+            && avio_open(&pFormat->pb, fileName.c_str(), AVIO_FLAG_WRITE) >= 0;
+    }
+
+    if (success) {
+        pStream->time_base = pContext->time_base;
+        success = avformat_write_header(pFormat, nullptr) >= 0;
+
+        for (size_t i=0; i<clip.frameCount && success; i++) {
+            success = av_frame_make_writable(pFrame) == 0;
+            FillYUV(pFrame, i);
+            pFrame->pts = i;
+            success = success && EncodeFrame(pFormat, pStream, pContext, pFrame, pPacket);
+        }
+
+        success = success && EncodeFrame(pFormat, pStream, pContext, nullptr, pPacket);
+        success = av_write_trailer(pFormat) == 0 && success;
+    }
+
+    if (!success)
+        fprintf(stderr, "Could not write %s.\n", fileName.c_str());
+
+    if (pFormat && pFormat->pb)
+        avio_closep(&pFormat->pb);
+    if (pFormat)
+        avformat_free_context(pFormat);
+    avcodec_free_context(&pContext);
+    av_packet_free(&pPacket);
+    av_frame_free(&pFrame);
+    return success;
+}
+
+void Put16(FILE* pFile, uint16_t value)
+{
+    fputc(value & 0xff, pFile);
+    fputc(value >> 8, pFile);
+}
+
+void Put32(FILE* pFile, uint32_t value)
+{
+    Put16(pFile, value);
+    Put16(pFile, value >> 16);
+}
+
+std::vector<uint8_t> EncodeImage(const Frame& frame, const char* pFormat)
+{
+    std::vector<uint8_t> image;
+
+    char*  pData = nullptr;
+    size_t size  = 0;
+    FILE*  pFile = open_memstream(&pData, &size);
+    if (!pFile)
+        return image;
+
+    ImageWriterOptions options;
+    options.format      = pFormat;
+    options.threadCount = 1;
+
+    ImageWriter* pWriter = ImageWriter::Create(pFile, options);
+    bool success = pWriter && pWriter->Begin(frame.GetWidth(), frame.GetHeight())
+        && pWriter->WriteRows(frame.GetData(), frame.GetHeight(), frame.GetStride()) && pWriter->End();
+    delete pWriter;
+
+    success = fclose(pFile) == 0 && success;
+    if (success)
+        image.assign(pData, pData + size);
+    free(pData);
+    return image;
+}
+
+bool WriteArchive(const ArchiveSpec& archive, const std::string& fileName)
+{
+    FILE* pFile = fopen(fileName.c_str(), "wb");
+    if (!pFile) {
+        fprintf(stderr, "Could not write %s.\n", fileName.c_str());
+        return false;
+    }
+
+    struct Entry
+    {
+        std::string     name;
+        uint32_t        checksum;
+        uint32_t        compressedSize;
+        uint32_t        size;
+        uint32_t        offset;
+    };
+
+    std::vector<Entry> entries;
+    Frame frame(archive.width, archive.height);
+    bool  success = true;
+
+    for (size_t i=0; i<archive.imageCount && success; i++) {
+        FillRGB(frame, i * SceneLength / 4);
+        std::vector<uint8_t> image = EncodeImage(frame, archive.pFormat);
+        success = !image.empty();
+
+        std::vector<uint8_t> compressed = image;
+        if (archive.deflated) {
+            uLongf compressedSize = compressBound(image.size());
+            compressed.resize(compressedSize);
+
+            // raw deflate, without the zlib header and checksum
+            z_stream stream;
+            ::memset(&stream, 0, sizeof(stream));
+            success = success && deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+            stream.next_in   = image.data();
+            stream.avail_in  = image.size();
+            stream.next_out  = compressed.data();
+            stream.avail_out = compressed.size();
+            success = success && deflate(&stream, Z_FINISH) == Z_STREAM_END;
+            compressed.resize(stream.total_out);
+            deflateEnd(&stream);
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "%04zu.%s", i, archive.pFormat[0] == 'j' ? "jpg" : archive.pFormat);
+
+        Entry entry;
+        entry.name           = name;
+        entry.checksum       = crc32(0, image.data(), image.size());
+        entry.compressedSize = compressed.size();
+        entry.size           = image.size();
+        entry.offset         = ftell(pFile);
+        entries.push_back(entry);
+
+        Put32(pFile, 0x04034b50);
+        Put16(pFile, 20);
+        Put16(pFile, 0);
+        Put16(pFile, archive.deflated ? 8 : 0);
+        Put32(pFile, 0);
+        Put32(pFile, entry.checksum);
+        Put32(pFile, entry.compressedSize);
+        Put32(pFile, entry.size);
+        Put16(pFile, entry.name.size());
+        Put16(pFile, 0);
+        fwrite(entry.name.data(), 1, entry.name.size(), pFile);
+        fwrite(compressed.data(), 1, compressed.size(), pFile);
+    }
+
+    uint32_t directoryOffset = ftell(pFile);
+    for (const Entry& entry : entries) {
+        Put32(pFile, 0x02014b50);
+        Put16(pFile, 20);
+        Put16(pFile, 20);
+        Put16(pFile, 0);
+        Put16(pFile, archive.deflated ? 8 : 0);
+        Put32(pFile, 0);
+        Put32(pFile, entry.checksum);
+        Put32(pFile, entry.compressedSize);
+        Put32(pFile, entry.size);
+        Put16(pFile, entry.name.size());
+        Put32(pFile, 0);
+        Put32(pFile, 0);
+        Put32(pFile, 0);
+        Put32(pFile, entry.offset);
+        fwrite(entry.name.data(), 1, entry.name.size(), pFile);
+    }
+    uint32_t directorySize = ftell(pFile) - directoryOffset;
+
+    Put32(pFile, 0x06054b50);
+    Put32(pFile, 0);
+    Put16(pFile, entries.size());
+    Put16(pFile, entries.size());
+    Put32(pFile, directorySize);
+    Put32(pFile, directoryOffset);
+    Put16(pFile, 0);
+
+    success = !ferror(pFile) && success;
+    success = fclose(pFile) == 0 && success;
+    if (!success)
+        fprintf(stderr, "Could not write %s.\n", fileName.c_str());
+    return success;
+}
+
+// written under a temporary name first, so an interrupted run leaves nothing
+// that looks complete
+template<typename Writer>
+bool CreateInput(const std::string& dirName, const std::string& name, Writer write)
+{
+    std::string fileName = dirName + "/" + name;
+    if (FileExists(fileName))
+        return true;
+
+    fprintf(stderr, "Writing %s...\n", name.c_str());
+    std::string tempName = dirName + "/partial-" + name;
+    if (!write(tempName)) {
+        remove(tempName.c_str());
+        return false;
+    }
+    return rename(tempName.c_str(), fileName.c_str()) == 0;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s directory\n", argv[0]);
+        return -1;
+    }
+
+    std::string dirName = argv[1];
+    mkdir(dirName.c_str(), 0755);
+
+    av_register_all();
+
+    std::string manifestName = dirName + "/corpus.txt";
+    FILE* pManifest = fopen(manifestName.c_str(), "w");
+    if (!pManifest) {
+        fprintf(stderr, "Could not write %s.\n", manifestName.c_str());
+        return -1;
+    }
+
+    // a missing encoder only leaves out its clips, anything else fails
+    bool success = true;
+    for (const ClipSpec& clip : Clips) {
+        char name[64];
+        snprintf(name, sizeof(name), "%s-%zux%zu-gop%d.%s", clip.pCodec, clip.width, clip.height, clip.gopSize, clip.pExtension);
+
+        if (!avcodec_find_encoder_by_name(clip.pCodec)) {
+            fprintf(stderr, "No %s encoder, leaving out %s.\n", clip.pCodec, name);
+            continue;
+        }
+
+        if (CreateInput(dirName, name, [&](const std::string& fileName) { return WriteClip(clip, fileName); }))
+            fprintf(pManifest, "%s\t%zu\n", name, clip.frameCount);
+        else
+            success = false;
+    }
+
+    for (const ArchiveSpec& archive : Archives) {
+        char name[64];
+        snprintf(name, sizeof(name), "%s-%s-%zux%zu.zip", archive.pFormat, archive.deflated ? "deflated" : "stored", archive.width, archive.height);
+
+        if (CreateInput(dirName, name, [&](const std::string& fileName) { return WriteArchive(archive, fileName); }))
+            fprintf(pManifest, "%s\t%zu\n", name, archive.imageCount);
+        else
+            success = false;
+    }
+
+    success = fclose(pManifest) == 0 && success;
+    return success ? 0 : -1;
+}
@@ -0,0 +1,319 @@
+// Runs vidthumb over every input of a corpus written by vidthumb_corpus and
+// compares wall time, decoded frames per second, peak memory and a checksum
+// of each overview to a baseline. Any of them getting worse by more than the
+// tolerance, an overview coming out different or an input the baseline has no
+// values for fails the run, and so does an empty baseline.
+//
+//   vidthumb_perf [-u] [-n runs] [-x tolerance] vidthumb corpus baseline [vidthumb options...]
+//
+// -u writes the measured values as the new baseline instead. Every input is
+// run several times and the best time and smallest peak memory are kept, so
+// a busy machine fails the check less easily than a slow vidthumb. The frame
+// rate is the number of frames vidthumb says it decoded, its output goes to
+// a .log file next to the overview.
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+struct Measurement
+{
+    double              wallTime    = 0.0;
+    double              frameRate   = 0.0;
+    long                peakMemory  = 0;
+    uint32_t            checksum    = 0;
+};
+
+bool ReadManifest(const std::string& fileName, std::vector<std::string>& inputs)
+{
+    FILE* pFile = fopen(fileName.c_str(), "r");
+    if (!pFile) {
+        fprintf(stderr, "Could not read %s, run vidthumb_corpus first.\n", fileName.c_str());
+        return false;
+    }
+
+    char   name[256];
+    size_t frameCount;
+    while (fscanf(pFile, "%255s %zu", name, &frameCount) == 2)
+        inputs.push_back(name);
+
+    fclose(pFile);
+    return true;
+}
+
+// a missing baseline is an empty one
+std::map<std::string, Measurement> ReadBaseline(const std::string& fileName)
+{
+    std::map<std::string, Measurement> baseline;
+
+    FILE* pFile = fopen(fileName.c_str(), "r");
+    if (!pFile)
+        return baseline;
+
+    char line[512];
+    while (fgets(line, sizeof(line), pFile)) {
+        if (line[0] == '#')
+            continue;
+
+        char        name[256];
+        Measurement measurement;
+        if (sscanf(line, "%255s %lf %lf %ld %x", name, &measurement.wallTime, &measurement.frameRate, &measurement.peakMemory, &measurement.checksum) == 5)
+            baseline[name] = measurement;
+    }
+
+    fclose(pFile);
+    return baseline;
+}
+
+bool WriteBaseline(const std::string& fileName, const std::vector<std::pair<std::string, Measurement>>& measurements)
+{
+    FILE* pFile = fopen(fileName.c_str(), "w");
+    if (!pFile) {
+        fprintf(stderr, "Could not write %s.\n", fileName.c_str());
+        return false;
+    }
+
+    fprintf(pFile, "# input\twall seconds\tframes/s\tpeak KiB\toverview crc32\n");
+    for (const auto& entry : measurements) {
+        const Measurement& measurement = entry.second;
+        fprintf(pFile, "%s\t%.3f\t%.1f\t%ld\t%08x\n", entry.first.c_str(), measurement.wallTime, measurement.frameRate, measurement.peakMemory, measurement.checksum);
+    }
+
+    return fclose(pFile) == 0;
+}
+
+bool GetChecksum(const std::string& fileName, uint32_t& checksum)
+{
+    FILE* pFile = fopen(fileName.c_str(), "rb");
+    if (!pFile)
+        return false;
+
+    uint8_t buffer[65536];
+    size_t  size;
+    checksum = crc32(0, nullptr, 0);
+    while ((size = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+        checksum = crc32(checksum, buffer, size);
+
+    fclose(pFile);
+    return true;
+}
+
+// the stats line vidthumb ends its log with
+bool GetDecodedFrameCount(const std::string& logName, size_t& frameCount)
+{
+    FILE* pFile = fopen(logName.c_str(), "r");
+    if (!pFile)
+        return false;
+
+    bool found = false;
+    char line[512];
+    while (fgets(line, sizeof(line), pFile)) {
+        if (sscanf(line, "Decoded %zu frames", &frameCount) == 1)
+            found = true;
+    }
+
+    fclose(pFile);
+    return found;
+}
+
+// one run of vidthumb in a process of its own, so its peak memory is its own
+bool RunOnce(const std::vector<std::string>& arguments, const std::string& logName, double& wallTime, long& peakMemory)
+{
+    std::vector<char*> argv;
+    for (const std::string& argument : arguments)
+        argv.push_back(const_cast<char*>(argument.c_str()));
+    argv.push_back(nullptr);
+
+    auto start = std::chrono::steady_clock::now();
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return false;
+    }
+
+    if (pid == 0) {
+        int log = open(logName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (log >= 0) {
+            dup2(log, STDOUT_FILENO);
+            dup2(log, STDERR_FILENO);
+        }
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+
+    int           status;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) < 0) {
+        if (errno != EINTR) {
+            perror("wait4");
+            return false;
+        }
+    }
+
+    wallTime   = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    peakMemory = usage.ru_maxrss;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+bool Measure(const std::vector<std::string>& arguments, const std::string& outputName, size_t runCount, Measurement& measurement)
+{
+    std::string logName = outputName + ".log";
+    size_t      frameCount = 0;
+
+    for (size_t i=0; i<runCount; i++) {
+        double wallTime;
+        long   peakMemory;
+        remove(outputName.c_str());
+        if (!RunOnce(arguments, logName, wallTime, peakMemory))
+            return false;
+
+        // the same every run, unless the decoding changes under us
+        if (!GetDecodedFrameCount(logName, frameCount)) {
+            fprintf(stderr, "No decoded frame count in %s.\n", logName.c_str());
+            return false;
+        }
+
+        if (i == 0 || wallTime < measurement.wallTime)
+            measurement.wallTime = wallTime;
+        if (i == 0 || peakMemory < measurement.peakMemory)
+            measurement.peakMemory = peakMemory;
+    }
+
+    measurement.frameRate = frameCount / measurement.wallTime;
+    return GetChecksum(outputName, measurement.checksum);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    bool   update    = false;
+    size_t runCount  = 3;
+    double tolerance = 0.25;
+    while (argc > 1 && argv[1][0] == '-') {
+        if (!strcmp(argv[1], "-u")) {
+            update = true;
+        } else if (!strcmp(argv[1], "-n") && argc > 2) {
+            runCount = std::max<size_t>(1, strtoul(argv[2], nullptr, 10));
+            argc--;
+            argv++;
+        } else if (!strcmp(argv[1], "-x") && argc > 2) {
+            tolerance = strtod(argv[2], nullptr);
+            argc--;
+            argv++;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[1]);
+            return -1;
+        }
+        argc--;
+        argv++;
+    }
+
+    if (argc < 4) {
+        fprintf(stderr, "Usage: vidthumb_perf [-u] [-n runs] [-x tolerance] vidthumb corpus baseline [vidthumb options...]\n");
+        return -1;
+    }
+
+    std::string programName  = argv[1];
+    std::string corpusName   = argv[2];
+    std::string baselineName = argv[3];
+
+    std::vector<std::string> inputs;
+    if (!ReadManifest(corpusName + "/corpus.txt", inputs))
+        return -1;
+
+    std::string outputDir = corpusName + "/out";
+    mkdir(outputDir.c_str(), 0755);
+
+    // nothing to compare to must not pass as nothing having regressed
+    std::map<std::string, Measurement> baseline = ReadBaseline(baselineName);
+    if (!update && baseline.empty()) {
+        fprintf(stderr, "No values in %s, record them with vidthumb_perf -u on this machine.\n", baselineName.c_str());
+        return -1;
+    }
+
+    std::vector<std::pair<std::string, Measurement>> measurements;
+
+    size_t failures = 0;
+    for (const std::string& name : inputs) {
+        std::string outputName = outputDir + "/" + name + ".png";
+
+        std::vector<std::string> arguments { programName };
+        arguments.insert(arguments.end(), argv + 4, argv + argc);
+        arguments.push_back(corpusName + "/" + name);
+        arguments.push_back(outputName);
+
+        Measurement measurement;
+        if (!Measure(arguments, outputName, runCount, measurement)) {
+            printf("%-40s FAILED to run\n", name.c_str());
+            failures++;
+            continue;
+        }
+        measurements.emplace_back(name, measurement);
+
+        printf("%-40s %8.3f s %8.1f frames/s %8ld KiB  %08x", name.c_str(), measurement.wallTime, measurement.frameRate, measurement.peakMemory, measurement.checksum);
+
+        auto found = baseline.find(name);
+        if (update) {
+            printf("\n");
+            continue;
+        }
+        if (found == baseline.end()) {
+            printf("  NOT IN BASELINE\n");
+            failures++;
+            continue;
+        }
+
+        const Measurement& expected = found->second;
+        std::string problems;
+        if (measurement.wallTime > expected.wallTime * (1.0 + tolerance))
+            problems += " time";
+        if (measurement.frameRate < expected.frameRate / (1.0 + tolerance))
+            problems += " frames/s";
+        if (measurement.peakMemory > expected.peakMemory * (1.0 + tolerance))
+            problems += " memory";
+        if (measurement.checksum != expected.checksum)
+            problems += " output";
+
+        if (problems.empty()) {
+            printf("  ok\n");
+        } else {
+            printf("  REGRESSED%s (baseline %.3f s %.1f frames/s %ld KiB %08x)\n", problems.c_str(),
+                expected.wallTime, expected.frameRate, expected.peakMemory, expected.checksum);
+            failures++;
+        }
+    }
+
+    if (update)
+        return WriteBaseline(baselineName, measurements) ? 0 : -1;
+
+    // a corpus that lost inputs measures less than the baseline did
+    size_t checkCount = inputs.size();
+    for (const auto& entry : baseline) {
+        if (std::find(inputs.begin(), inputs.end(), entry.first) == inputs.end()) {
+            printf("%-40s NOT IN CORPUS\n", entry.first.c_str());
+            failures++;
+            checkCount++;
+        }
+    }
+
+    printf("%zu of %zu inputs failed.\n", failures, checkCount);
+    return failures == 0 ? 0 : -1;
+}
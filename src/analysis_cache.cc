@@ -0,0 +1,219 @@
+#include "analysis_cache.hh"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace vidthumb {
+
+static const char     CacheMagic[8]   = { 'V', 'T', 'C', 'A', 'C', 'H', 'E', 0 };
+// 2 since segments end at presentation rather than decode time stamps
+static const uint32_t CacheVersion    = 2;
+
+// followed by the arrays, widest elements first so all of them are aligned:
+// frame times and time stamps, then differences and contrasts, then key flags
+struct AnalysisCacheHeader
+{
+    char                magic[8];
+    uint32_t            version;
+    uint32_t            headerSize;
+
+    uint64_t            fileSize;
+    int64_t             modificationTime;
+    uint32_t            checksum;
+    uint32_t            analysisWidth;
+    uint32_t            analysisHeight;
+    uint32_t            keyFramesOnly;
+
+    uint64_t            frameCount;
+    uint64_t            indexCount;
+};
+
+static size_t GetCacheSize(size_t frameCount, size_t indexCount)
+{
+    return sizeof(AnalysisCacheHeader) 
+        + frameCount * sizeof(double) + indexCount * sizeof(int64_t)
+        + frameCount * 2 * sizeof(float) + indexCount;
+}
+
+AnalysisCache::AnalysisCache() :
+    pMapping                    { nullptr },
+    MappingSize                 { 0 },
+    FrameCount                  { 0 },
+    IndexCount                  { 0 },
+    pDifferences                { nullptr },
+    pContrasts                  { nullptr },
+    pFrameTimes                 { nullptr },
+    pTimeStamps                 { nullptr },
+    pKeyFrameFlags              { nullptr }
+{
+}
+
+AnalysisCache::~AnalysisCache()
+{
+    this->Unload();
+}
+
+std::string AnalysisCache::GetFileName(const char *pCacheDir, const AnalysisKey& key)
+{
+    char fileName[128];
+    snprintf(fileName, sizeof(fileName), "/%016llx-%08x-%ux%u%s.vtc",
+        (unsigned long long)key.file.size, key.file.checksum,
+        key.analysisWidth, key.analysisHeight, key.keyFramesOnly ? "-k" : "");
+    return std::string(pCacheDir) + fileName;
+}
+
+bool AnalysisCache::Load(const char *pFileName, const AnalysisKey& key)
+{
+    this->Unload();
+
+    int fd = open(pFileName, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || (size_t)fileStat.st_size < sizeof(AnalysisCacheHeader)) {
+        close(fd);
+        return false;
+    }
+
+    // the mapping stays valid after the descriptor is closed
+    void* pMapping = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (pMapping == MAP_FAILED)
+        return false;
+
+    this->pMapping    = pMapping;
+    this->MappingSize = fileStat.st_size;
+
+    const AnalysisCacheHeader* pHeader = (const AnalysisCacheHeader*)pMapping;
+    bool valid = 
+        !memcmp(pHeader->magic, CacheMagic, sizeof(CacheMagic)) &&
+        pHeader->version            == CacheVersion &&
+        pHeader->headerSize         == sizeof(AnalysisCacheHeader) &&
+        pHeader->fileSize           == key.file.size &&
+        pHeader->modificationTime   == key.file.modificationTime &&
+        pHeader->checksum           == key.file.checksum &&
+        pHeader->analysisWidth      == key.analysisWidth &&
+        pHeader->analysisHeight     == key.analysisHeight &&
+        pHeader->keyFramesOnly      == (uint32_t)key.keyFramesOnly &&
+        (pHeader->indexCount == 0 || pHeader->indexCount == pHeader->frameCount) &&
+        GetCacheSize(pHeader->frameCount, pHeader->indexCount) == this->MappingSize;
+
+    if (!valid) {
+        this->Unload();
+        return false;
+    }
+
+    this->FrameCount = pHeader->frameCount;
+    this->IndexCount = pHeader->indexCount;
+
+    const uint8_t* pData = (const uint8_t*)(pHeader + 1);
+    this->pFrameTimes    = (const double*)pData;    pData += this->FrameCount * sizeof(double);
+    this->pTimeStamps    = (const int64_t*)pData;   pData += this->IndexCount * sizeof(int64_t);
+    this->pDifferences   = (const float*)pData;     pData += this->FrameCount * sizeof(float);
+    this->pContrasts     = (const float*)pData;     pData += this->FrameCount * sizeof(float);
+    this->pKeyFrameFlags = pData;
+
+    // read front to back during selection
+    madvise(this->pMapping, this->MappingSize, MADV_SEQUENTIAL);
+    return true;
+}
+
+void AnalysisCache::Unload()
+{
+    if (this->pMapping)
+        munmap(this->pMapping, this->MappingSize);
+
+    this->pMapping       = nullptr;
+    this->MappingSize    = 0;
+    this->FrameCount     = 0;
+    this->IndexCount     = 0;
+    this->pDifferences   = nullptr;
+    this->pContrasts     = nullptr;
+    this->pFrameTimes    = nullptr;
+    this->pTimeStamps    = nullptr;
+    this->pKeyFrameFlags = nullptr;
+}
+
+bool AnalysisCache::Save(const char *pFileName, const AnalysisKey& key, size_t frameCount,
+                         const float* pDifferences, const float* pContrasts, const double* pFrameTimes,
+                         const std::vector<FrameIndexEntry>& frameIndex)
+{
+    size_t indexCount = frameIndex.size() == frameCount ? frameCount : 0;
+
+    AnalysisCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+    header.version          = CacheVersion;
+    header.headerSize       = sizeof(AnalysisCacheHeader);
+    header.fileSize         = key.file.size;
+    header.modificationTime = key.file.modificationTime;
+    header.checksum         = key.file.checksum;
+    header.analysisWidth    = key.analysisWidth;
+    header.analysisHeight   = key.analysisHeight;
+    header.keyFramesOnly    = key.keyFramesOnly;
+    header.frameCount       = frameCount;
+    header.indexCount       = indexCount;
+
+    std::vector<int64_t> timeStamps(indexCount);
+    std::vector<uint8_t> keyFrameFlags(indexCount);
+    for (size_t i=0; i<indexCount; i++) {
+        timeStamps[i]    = frameIndex[i].timeStamp;
+        keyFrameFlags[i] = frameIndex[i].isKeyFrame;
+    }
+
+    // written under a temporary name, so readers never see half a file, and
+    // a unique one, as other workers may be saving the same input right now
+    std::vector<char> tempName(pFileName, pFileName + strlen(pFileName));
+    const char tempSuffix[] = ".XXXXXX";
+    tempName.insert(tempName.end(), tempSuffix, tempSuffix + sizeof(tempSuffix));
+
+    int   fd    = mkstemp(tempName.data());
+    FILE* pFile = fd >= 0 ? fdopen(fd, "wb") : nullptr;
+    if (!pFile) {
+        fprintf(stderr, "Could not write analysis cache %s.\n", pFileName);
+        if (fd >= 0) {
+            close(fd);
+            remove(tempName.data());
+        }
+        return false;
+    }
+
+    // mkstemp only lets the owner read it
+    fchmod(fd, 0644);
+
+    bool success = 
+        fwrite(&header, sizeof(header), 1, pFile) == 1 &&
+        fwrite(pFrameTimes, sizeof(double), frameCount, pFile) == frameCount &&
+        fwrite(timeStamps.data(), sizeof(int64_t), indexCount, pFile) == indexCount &&
+        fwrite(pDifferences, sizeof(float), frameCount, pFile) == frameCount &&
+        fwrite(pContrasts, sizeof(float), frameCount, pFile) == frameCount &&
+        fwrite(keyFrameFlags.data(), 1, indexCount, pFile) == indexCount;
+
+    success = fclose(pFile) == 0 && success;
+    success = success && rename(tempName.data(), pFileName) == 0;
+
+    if (!success) {
+        fprintf(stderr, "Could not write analysis cache %s.\n", pFileName);
+        remove(tempName.data());
+    }
+    return success;
+}
+
+std::vector<FrameIndexEntry> AnalysisCache::GetFrameIndex() const
+{
+    std::vector<FrameIndexEntry> frameIndex(this->IndexCount);
+    for (size_t i=0; i<this->IndexCount; i++) {
+        frameIndex[i].timeStamp  = this->pTimeStamps[i];
+        frameIndex[i].isKeyFrame = this->pKeyFrameFlags[i] != 0;
+    }
+    return frameIndex;
+}
+
+}
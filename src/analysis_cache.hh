@@ -0,0 +1,72 @@
+#pragma once
+
+#include "file_fingerprint.hh"
+#include "stream.hh"
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace vidthumb 
+{
+
+// what the per frame metrics of an input depend on
+struct AnalysisKey
+{
+    FileFingerprint     file;
+    uint32_t            analysisWidth;
+    uint32_t            analysisHeight;
+    bool                keyFramesOnly;
+};
+
+// Per frame metrics, times and time stamps of an analysed input, kept in a 
+// binary file per key so later runs with other grid or selection settings 
+// can skip the analysis. Loaded files are memory mapped and read in place.
+class AnalysisCache
+{
+public:
+
+                        AnalysisCache();
+                        ~AnalysisCache();
+
+                        AnalysisCache(const AnalysisCache&) = delete;
+    AnalysisCache&      operator=(const AnalysisCache&) = delete;
+
+    // name of the cache file for the key inside the cache directory
+    static std::string  GetFileName(const char *pCacheDir, const AnalysisKey& key);
+
+    // map a cache file, false if there is none or it doesn't match the key
+    bool                Load(const char *pFileName, const AnalysisKey& key);
+    void                Unload();
+
+    // write the metrics, the frame index is only kept if it covers all frames
+    static bool         Save(const char *pFileName, const AnalysisKey& key, size_t frameCount,
+                             const float* pDifferences, const float* pContrasts, const double* pFrameTimes,
+                             const std::vector<FrameIndexEntry>& frameIndex);
+
+    size_t              GetFrameCount() const { return this->FrameCount; }
+
+    const float*        GetDifferences() const { return this->pDifferences; }
+    const float*        GetContrasts() const { return this->pContrasts; }
+    const double*       GetFrameTimes() const { return this->pFrameTimes; }
+
+    // empty if the stream did not provide one
+    std::vector<FrameIndexEntry> GetFrameIndex() const;
+
+private:
+
+    void*               pMapping;
+    size_t              MappingSize;
+
+    size_t              FrameCount;
+    size_t              IndexCount;
+
+    const float*        pDifferences;
+    const float*        pContrasts;
+    const double*       pFrameTimes;
+    const int64_t*      pTimeStamps;
+    const uint8_t*      pKeyFrameFlags;
+};
+
+}
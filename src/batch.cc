@@ -0,0 +1,336 @@
+#include "batch.hh"
+#include "stream.hh"
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace vidthumb {
+
+// guards against symlink loops
+static const size_t MaxDirectoryDepth = 32;
+
+// what a directory scan picks up, everything else is left alone
+static const char* const InputExtensions[] = {
+    "3g2", "3gp", "asf", "avi", "cbz", "divx", "f4v", "flv", "m2ts", "m2v", "m4v",
+    "mkv", "mov", "mp4", "mpeg", "mpg", "mts", "mxf", "ogm", "ogv", "qt", "rm",
+    "rmvb", "ts", "vob", "webm", "wmv", "zip",
+};
+
+static bool EndsWith(const std::string& s, const char *pSuffix)
+{
+    size_t length = strlen(pSuffix);
+    return s.size() >= length && s.compare(s.size() - length, length, pSuffix) == 0;
+}
+
+static bool IsInputName(const std::string& fileName)
+{
+    size_t dot = fileName.find_last_of("./");
+    if (dot == std::string::npos || fileName[dot] != '.')
+        return false;
+
+    std::string extension = fileName.substr(dot + 1);
+    for (char& c : extension)
+        c = tolower((unsigned char)c);
+
+    for (const char* pExtension : InputExtensions) {
+        if (extension == pExtension)
+            return true;
+    }
+    return false;
+}
+
+Batch::Batch(const OverviewOptions& options) :
+    Options                     { options },
+    OptionsHash                 { 0 }
+{
+    // workers report per input, the per frame progress would just interleave
+    this->Options.verbose = false;
+
+    // an overview made with other options does not count as up to date
+    char optionsString[256];
+    snprintf(optionsString, sizeof(optionsString), "%d %d %d %zux%zu %zux%zu %zux%zu %g %s %d %d",
+        this->Options.portrait, this->Options.singlePass, this->Options.keyFramesOnly,
+        this->Options.columns, this->Options.rows, this->Options.thumbWidth, this->Options.thumbHeight,
+        this->Options.analysisWidth, this->Options.analysisHeight, this->Options.timeBudget,
+        this->Options.output.format.c_str(), this->Options.output.quality, this->Options.output.compressionLevel);
+    this->OptionsHash = crc32(0, (const Bytef*)optionsString, strlen(optionsString));
+
+    this->OutputExtension = "." + (this->Options.output.format.empty() ? std::string("png") : this->Options.output.format);
+}
+
+bool Batch::AddManifest(const char *pFileName)
+{
+    FILE* pFile = fopen(pFileName, "r");
+    if (!pFile) {
+        fprintf(stderr, "Could not open manifest %s.\n", pFileName);
+        return false;
+    }
+
+    char line[4096];
+    while (fgets(line, sizeof(line), pFile)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] == 0 || line[0] == '#')
+            continue;
+
+        Job job;
+        char* pTab = strchr(line, '\t');
+        if (pTab) {
+            *pTab = 0;
+            job.outputName = pTab + 1;
+        }
+        job.inputName = line;
+        if (job.outputName.empty())
+            job.outputName = job.inputName + this->OutputExtension;
+
+        this->Jobs.push_back(job);
+    }
+
+    fclose(pFile);
+    return true;
+}
+
+bool Batch::AddDirectory(const char *pDirName)
+{
+    size_t firstJob = this->Jobs.size();
+    if (!this->ScanDirectory(pDirName, 0))
+        return false;
+
+    // readdir order is arbitrary
+    std::sort(this->Jobs.begin() + firstJob, this->Jobs.end(), [](const Job& a, const Job& b) {
+        return a.inputName < b.inputName;
+    });
+    return true;
+}
+
+bool Batch::ScanDirectory(const std::string& dirName, size_t depth)
+{
+    DIR* pDir = opendir(dirName.c_str());
+    if (!pDir) {
+        fprintf(stderr, "Could not open directory %s.\n", dirName.c_str());
+        return false;
+    }
+
+    while (struct dirent* pEntry = readdir(pDir)) {
+        // skips . and .. as well as the state file
+        if (pEntry->d_name[0] == '.')
+            continue;
+
+        std::string fileName = dirName + "/" + pEntry->d_name;
+
+        struct stat fileStat;
+        if (stat(fileName.c_str(), &fileStat) != 0)
+            continue;
+
+        if (S_ISDIR(fileStat.st_mode)) {
+            if (depth < MaxDirectoryDepth)
+                this->ScanDirectory(fileName, depth + 1);
+            continue;
+        }
+
+        // subtitles, notes, partial downloads and overviews are not inputs
+        if (!S_ISREG(fileStat.st_mode) || !IsInputName(fileName) || EndsWith(fileName, this->OutputExtension.c_str()))
+            continue;
+
+        Job job;
+        job.inputName  = fileName;
+        job.outputName = fileName + this->OutputExtension;
+        this->Jobs.push_back(job);
+    }
+
+    closedir(pDir);
+    return true;
+}
+
+bool Batch::LoadState(const char *pFileName)
+{
+    this->StateFileName = pFileName;
+    this->State.clear();
+
+    FILE* pFile = fopen(pFileName, "r");
+    if (!pFile)
+        return false;
+
+    // "size mtime fingerprint options<TAB>input<TAB>output", later lines win
+    char line[8192];
+    while (fgets(line, sizeof(line), pFile)) {
+        line[strcspn(line, "\r\n")] = 0;
+
+        FileState state;
+        unsigned long long size;
+        long long modificationTime;
+        unsigned int fingerprint, optionsHash;
+        int offset = 0;
+        if (sscanf(line, "%llu %lld %x %x\t%n", &size, &modificationTime, &fingerprint, &optionsHash, &offset) != 4 || offset == 0)
+            continue;
+
+        char* pInputName  = line + offset;
+        char* pOutputName = strchr(pInputName, '\t');
+        if (!pOutputName)
+            continue;
+        *pOutputName++ = 0;
+
+        state.fingerprint.size             = size;
+        state.fingerprint.modificationTime = modificationTime;
+        state.fingerprint.checksum         = fingerprint;
+        state.optionsHash                  = optionsHash;
+        state.outputName                   = pOutputName;
+        this->State[pInputName] = state;
+    }
+
+    fclose(pFile);
+    return true;
+}
+
+bool Batch::SaveState()
+{
+    if (this->StateFileName.empty())
+        return true;
+
+    // rewrite compacted and replace atomically, the appended lines stay valid until then
+    std::string tempName = this->StateFileName + ".tmp";
+    FILE* pFile = fopen(tempName.c_str(), "w");
+    if (!pFile) {
+        fprintf(stderr, "Could not write state file %s.\n", tempName.c_str());
+        return false;
+    }
+
+    for (auto& entry : this->State) {
+        const FileState& state = entry.second;
+        fprintf(pFile, "%llu %lld %08x %08x\t%s\t%s\n",
+            (unsigned long long)state.fingerprint.size, (long long)state.fingerprint.modificationTime,
+            state.fingerprint.checksum, state.optionsHash,
+            entry.first.c_str(), state.outputName.c_str());
+    }
+
+    bool success = fclose(pFile) == 0 && rename(tempName.c_str(), this->StateFileName.c_str()) == 0;
+    if (!success)
+        fprintf(stderr, "Could not write state file %s.\n", this->StateFileName.c_str());
+    return success;
+}
+
+bool Batch::IsUpToDate(const Job& job, const FileFingerprint& current)
+{
+    std::lock_guard<std::mutex> lock(this->StateMutex);
+
+    auto it = this->State.find(job.inputName);
+    if (it == this->State.end())
+        return false;
+
+    // an input that could not be opened stays unsupported until it changes
+    const FileState& last = it->second;
+    if (last.outputName.empty())
+        return last.fingerprint == current;
+
+    return last.fingerprint == current
+        && last.optionsHash == this->OptionsHash
+        && last.outputName == job.outputName
+        && access(job.outputName.c_str(), F_OK) == 0;
+}
+
+void Batch::RecordState(const Job& job, const FileFingerprint& current, bool supported)
+{
+    std::lock_guard<std::mutex> lock(this->StateMutex);
+
+    FileState& state = this->State[job.inputName];
+    state.fingerprint = current;
+    state.optionsHash = this->OptionsHash;
+    state.outputName  = supported ? job.outputName : std::string();
+
+    if (this->StateFileName.empty())
+        return;
+
+    // append right away, so an interrupted run does not lose what it did
+    FILE* pFile = fopen(this->StateFileName.c_str(), "a");
+    if (pFile) {
+        fprintf(pFile, "%llu %lld %08x %08x\t%s\t%s\n",
+            (unsigned long long)state.fingerprint.size, (long long)state.fingerprint.modificationTime,
+            state.fingerprint.checksum, state.optionsHash,
+            job.inputName.c_str(), state.outputName.c_str());
+        fclose(pFile);
+    }
+}
+
+bool Batch::CanOpen(const Job& job)
+{
+    Stream* pStream = Stream::Open(job.inputName.c_str(), 320, 200, 1);
+    delete pStream;
+    return pStream != nullptr;
+}
+
+size_t Batch::Run(size_t workerCount)
+{
+    if (workerCount == 0)
+        workerCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+    workerCount = std::max<size_t>(1, std::min(workerCount, this->Jobs.size()));
+
+    // the workers already keep the cores busy
+    if (workerCount > 1 && this->Options.threadCount == 0)
+        this->Options.threadCount = 1;
+    if (workerCount > 1 && this->Options.segmentCount == 0)
+        this->Options.segmentCount = 1;
+
+    std::atomic<size_t> nextJob      { 0 };
+    std::atomic<size_t> failedCount  { 0 };
+    std::atomic<size_t> skippedCount { 0 };
+    std::atomic<size_t> unsupportedCount { 0 };
+    std::mutex          logMutex;
+
+    auto worker = [&]() {
+        for (;;) {
+            size_t jobIndex = nextJob++;
+            if (jobIndex >= this->Jobs.size())
+                break;
+
+            const Job&      job = this->Jobs[jobIndex];
+            FileFingerprint current;
+            const char*     pResult;
+
+            if (!GetFileFingerprint(job.inputName.c_str(), current)) {
+                pResult = "missing";
+                failedCount++;
+            } else if (this->IsUpToDate(job, current)) {
+                pResult = "skipped";
+                skippedCount++;
+            } else if (CreateOverview(job.inputName.c_str(), job.outputName.c_str(), this->Options)) {
+                pResult = "done";
+                this->RecordState(job, current, true);
+            } else if (!this->CanOpen(job)) {
+                // not going to work on the next run either
+                pResult = "unsupported";
+                unsupportedCount++;
+                this->RecordState(job, current, false);
+            } else {
+                pResult = "failed";
+                failedCount++;
+            }
+
+            std::lock_guard<std::mutex> lock(logMutex);
+            std::cerr << "[" << (jobIndex + 1) << "/" << this->Jobs.size() << "] " << pResult << ": " << job.inputName << std::endl;
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i=1; i<workerCount; i++)
+        workers.emplace_back(worker);
+    worker();
+
+    for (auto& thread : workers)
+        thread.join();
+
+    this->SaveState();
+
+    std::cerr << this->Jobs.size() << " inputs, " << skippedCount << " up to date, " << unsupportedCount << " unsupported, " << failedCount << " failed." << std::endl;
+    return failedCount;
+}
+
+}
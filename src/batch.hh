@@ -0,0 +1,76 @@
+#pragma once
+
+#include "file_fingerprint.hh"
+#include "overview.hh"
+
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace vidthumb 
+{
+
+// Creates the overviews of many inputs on a pool of worker threads. Inputs
+// whose size, modification time and content fingerprint still match the last
+// successful run recorded in the state file are skipped.
+class Batch
+{
+public:
+
+                        Batch(const OverviewOptions& options);
+
+    // one input per line, optionally followed by a tab and the output name
+    bool                AddManifest(const char *pFileName);
+
+    // every video or zip file below the directory, overviews are written next
+    // to the inputs
+    bool                AddDirectory(const char *pDirName);
+
+    // read the results of earlier runs, and record the new ones there
+    bool                LoadState(const char *pFileName);
+
+    // process all inputs with the given number of workers, 0 for one per core,
+    // and return the number of inputs that failed, inputs that can't be
+    // opened at all are recorded as unsupported instead
+    size_t              Run(size_t workerCount);
+
+private:
+
+    struct Job
+    {
+        std::string     inputName;
+        std::string     outputName;
+    };
+
+    struct FileState
+    {
+        FileFingerprint fingerprint;
+        uint32_t        optionsHash;
+
+        // empty for inputs that are not supported
+        std::string     outputName;
+    };
+
+    OverviewOptions     Options;
+    uint32_t            OptionsHash;
+
+    // appended to the input names for outputs that are not named explicitly
+    std::string         OutputExtension;
+
+    std::vector<Job>    Jobs;
+
+    std::string         StateFileName;
+    std::map<std::string, FileState> State;
+    std::mutex          StateMutex;
+
+    bool                ScanDirectory(const std::string& dirName, size_t depth);
+    bool                IsUpToDate(const Job& job, const FileFingerprint& current);
+    void                RecordState(const Job& job, const FileFingerprint& current, bool supported);
+    bool                CanOpen(const Job& job);
+    bool                SaveState();
+};
+
+}
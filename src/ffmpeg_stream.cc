@@ -4,24 +4,52 @@
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
+#include <libavutil/pixdesc.h>
 #include <libswscale/swscale.h>
 }
 
 #include <algorithm>
+#include <cstring>
+#include <mutex>
 
 namespace vidthumb {
 
+// read buffer for inputs that are not files
+static const int IOBufferSize = 65536;
+
 FFMpegStream::FFMpegStream(size_t targetWidth, size_t targetHeight) :
     Stream                      { targetWidth, targetHeight },
     ResultCode                  { 0 },
     pFormatContext              { nullptr },
+    pIOContext                  { nullptr },
+    InputPosition               { 0 },
     VideoStreamIndex            { 0 },
     pVideoStreamCodecContext    { nullptr },
     pFrame                      { nullptr },
-    pTargetFrame                { nullptr },
+    pPacket                     { nullptr },
     pSwsContextLQ               { nullptr },
-    pSwsContextHQ               { nullptr }
+    pSwsContextHQ               { nullptr },
+    FrameRate                   { 0.0 },
+    TimeBase                    { 0.0 },
+    StartTime                   { 0 },
+    FrameCountEstimate          { 0 },
+    NextKeyFrame                { 0 },
+    SeekKeyFrames               { false },
+    KeyFramesOnly               { false },
+    SegmentStart                { AV_NOPTS_VALUE },
+    SegmentEnd                  { AV_NOPTS_VALUE },
+    SegmentKeyFrame             { 0 },
+    FrameTimeStamp              { 0 },
+    HasPendingFrame             { false },
+    StopDecoding                { false },
+    DecodeAheadDone             { false }
 {
+    // streams are opened from several threads at once, and by programs
+    // using the library that don't set up ffmpeg themselves
+    static std::once_flag initFlag;
+    std::call_once(initFlag, []() {
+        av_register_all();
+    });
 }
 
 FFMpegStream::~FFMpegStream()
@@ -29,11 +57,30 @@ FFMpegStream::~FFMpegStream()
     this->Close();
 }
 
-bool FFMpegStream::Open(const char *pFileName)
+bool FFMpegStream::Open(const StreamInput& input)
 {
     this->Close();
 
+    // memory and callbacks are read through an I/O context of our own
+    if (!input.IsFile()) {
+        uint8_t* pBuffer = (uint8_t*)av_malloc(IOBufferSize);
+        this->pIOContext = pBuffer ? avio_alloc_context(pBuffer, IOBufferSize, 0, this, &FFMpegStream::ReadInput, nullptr,
+                                                       input.IsSeekable() ? &FFMpegStream::SeekInput : nullptr) : nullptr;
+        this->pFormatContext = avformat_alloc_context();
+        if (!this->pIOContext || !this->pFormatContext) {
+            if (!this->pIOContext)
+                av_free(pBuffer);
+            fprintf(stderr, "Could not allocate input context.\n");
+            this->Close();
+            return false;
+        }
+
+        this->InputPosition = 0;
+        this->pFormatContext->pb = this->pIOContext;
+    }
+
     // open file
+    const char* pFileName = input.IsFile() ? input.fileName.c_str() : "";
     this->ResultCode = avformat_open_input(&this->pFormatContext, pFileName, nullptr, nullptr);
     if (this->ResultCode != 0) {
         this->Close();
@@ -50,28 +97,48 @@ bool FFMpegStream::Open(const char *pFileName)
     av_dump_format(this->pFormatContext, 0, pFileName, 0);
     
     // find video stream
-    AVCodecContext* pCodecContext = nullptr;
+    AVCodecParameters* pCodecParameters = nullptr;
     for (size_t i=0; i<this->pFormatContext->nb_streams; i++) {
-        AVCodecContext* pStreamCodecContext = this->pFormatContext->streams[i]->codec;
-        if (pStreamCodecContext->codec_type == AVMEDIA_TYPE_VIDEO) {
+        AVCodecParameters* pStreamCodecParameters = this->pFormatContext->streams[i]->codecpar;
+        if (pStreamCodecParameters->codec_type == AVMEDIA_TYPE_VIDEO) {
             this->VideoStreamIndex = i;
-            pCodecContext = pStreamCodecContext;
+            pCodecParameters = pStreamCodecParameters;
 
             auto fpsRatio = this->pFormatContext->streams[i]->avg_frame_rate;
             double fps = (double)fpsRatio.num / fpsRatio.den;
             this->totalFrameCount = fps * this->pFormatContext->duration / (double)AV_TIME_BASE;
+            this->FrameCountEstimate = this->totalFrameCount;
+            this->FrameRate = fps;
             break;
         }
     }
 
-    if (pCodecContext == nullptr) {
+    if (pCodecParameters == nullptr) {
         fprintf(stderr, "Could not find video stream.\n");
         this->Close();
         return false;
     }
 
+    AVStream* pVideoStream = this->pFormatContext->streams[this->VideoStreamIndex];
+    this->TimeBase = av_q2d(pVideoStream->time_base);
+    this->StartTime = pVideoStream->start_time != AV_NOPTS_VALUE ? pVideoStream->start_time : 0;
+
+    if (pVideoStream->duration != AV_NOPTS_VALUE)
+        this->duration = pVideoStream->duration * this->TimeBase;
+    else if (this->pFormatContext->duration != AV_NOPTS_VALUE)
+        this->duration = this->pFormatContext->duration / (double)AV_TIME_BASE;
+
+    for (int i=0; i<pVideoStream->nb_index_entries; i++) {
+        if (pVideoStream->index_entries[i].flags & AVINDEX_KEYFRAME)
+            this->KeyFrameTimeStamps.push_back(pVideoStream->index_entries[i].timestamp);
+    }
+    this->KeyFramePresentationTimeStamps.assign(this->KeyFrameTimeStamps.size(), AV_NOPTS_VALUE);
+
+    // seeking from key frame to key frame only pays off for long GOPs
+    this->SeekKeyFrames = this->KeyFrameTimeStamps.size() * 4 < this->FrameCountEstimate;
+
     // open video codec
-    AVCodec* pCodec = avcodec_find_decoder(pCodecContext->codec_id);
+    AVCodec* pCodec = avcodec_find_decoder(pCodecParameters->codec_id);
     if (pCodec == nullptr) {
         fprintf(stderr, "Could not find suitable codec.\n");
         this->Close();
@@ -79,12 +146,16 @@ bool FFMpegStream::Open(const char *pFileName)
     }
 
     this->pVideoStreamCodecContext = avcodec_alloc_context3(pCodec);
-    this->ResultCode = avcodec_copy_context(this->pVideoStreamCodecContext, pCodecContext);
-    if (this->ResultCode != 0) {
+    this->ResultCode = avcodec_parameters_to_context(this->pVideoStreamCodecContext, pCodecParameters);
+    if (this->ResultCode < 0) {
         this->Close();
         return false;
     }
 
+    // let the decoder use frame and slice threads, a thread count of 0 means one per core
+    this->pVideoStreamCodecContext->thread_count = this->ThreadCount;
+    this->pVideoStreamCodecContext->thread_type  = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
     this->ResultCode = avcodec_open2(this->pVideoStreamCodecContext, pCodec, nullptr);
     if (this->ResultCode != 0) {
         this->Close();
@@ -99,9 +170,9 @@ bool FFMpegStream::Open(const char *pFileName)
         return false;
     }
 
-    this->pTargetFrame = av_frame_alloc();
-    if (!this->pTargetFrame) {
-        fprintf(stderr, "Could not allocate frame data.\n");
+    this->pPacket = av_packet_alloc();
+    if (!this->pPacket) {
+        fprintf(stderr, "Could not allocate packet.\n");
         this->Close();
         return false;
     }
@@ -110,21 +181,14 @@ bool FFMpegStream::Open(const char *pFileName)
     size_t width  = this->pVideoStreamCodecContext->width;
     size_t height = this->pVideoStreamCodecContext->height;
 
-    this->pFrameData = (uint8_t*)aligned_alloc(32, avpicture_get_size(this->pVideoStreamCodecContext->pix_fmt, width, height));
-
-    avpicture_fill((AVPicture*)this->pFrame, this->pFrameData, this->pVideoStreamCodecContext->pix_fmt, width, height);
-
     // rescale target size
     float scale = std::min( (float)this->TargetWidth / width, (float)this->TargetHeight / height );
     this->TargetWidth = width*scale;
     this->TargetHeight = height*scale;
 
-    this->pTargetFrameData = (uint8_t*)aligned_alloc(32, avpicture_get_size(format, this->TargetWidth, this->TargetHeight));
-    avpicture_fill((AVPicture*)this->pTargetFrame, this->pTargetFrameData, format, this->TargetWidth, this->TargetHeight);
-
 //    this->pSwsContext = sws_getContext(width, height, this->pVideoStreamCodecContext->pix_fmt, this->TargetWidth, this->TargetHeight, format, SWS_LANCZOS, nullptr, nullptr, nullptr);
 
-    this->pSwsContextLQ = sws_getContext(width, height, this->pVideoStreamCodecContext->pix_fmt, this->TargetWidth, this->TargetHeight, format, SWS_POINT, nullptr, nullptr, nullptr);
+    // the analysis scaler is set up on first use, once the decoded format and analysis size are known
     this->pSwsContextHQ = sws_getContext(width, height, this->pVideoStreamCodecContext->pix_fmt, this->TargetWidth, this->TargetHeight, format, SWS_LANCZOS, nullptr, nullptr, nullptr);
 
     return true;
@@ -132,6 +196,8 @@ bool FFMpegStream::Open(const char *pFileName)
 
 void FFMpegStream::Close()
 {
+    this->StopDecodeAhead();
+
     if (this->ResultCode != 0) {
         switch(this->ResultCode) {
             default:
@@ -143,14 +209,33 @@ void FFMpegStream::Close()
         avformat_close_input(&this->pFormatContext);
 
     this->pFormatContext = nullptr;
-    this->VideoStreamIndex = 0;
 
-    if (this->pVideoStreamCodecContext) {
-        avcodec_close(this->pVideoStreamCodecContext);
-        av_free(this->pVideoStreamCodecContext);
+    // a custom I/O context is left to its owner by avformat
+    if (this->pIOContext) {
+        av_freep(&this->pIOContext->buffer);
+        av_freep(&this->pIOContext);
     }
+    this->pIOContext = nullptr;
+    this->VideoStreamIndex = 0;
+
+    this->KeyFrameTimeStamps.clear();
+    this->KeyFramePresentationTimeStamps.clear();
+    this->NextKeyFrame = 0;
+    this->SeekKeyFrames = false;
+    this->SegmentStart = AV_NOPTS_VALUE;
+    this->SegmentEnd = AV_NOPTS_VALUE;
+    this->SegmentKeyFrame = 0;
+    this->HasPendingFrame = false;
+    this->frameIndex.clear();
+
+    if (this->pVideoStreamCodecContext)
+        avcodec_free_context(&this->pVideoStreamCodecContext);
     this->pVideoStreamCodecContext = nullptr; 
 
+    if (this->pPacket)
+        av_packet_free(&this->pPacket);
+    this->pPacket = nullptr;
+
     if (this->pSwsContextLQ)
         sws_freeContext(this->pSwsContextLQ);
     this->pSwsContextLQ = nullptr;
@@ -159,86 +244,494 @@ void FFMpegStream::Close()
         sws_freeContext(this->pSwsContextHQ);
     this->pSwsContextHQ = nullptr;
 
+    this->SetDecodeAhead(0);
+
     if (this->pFrame) 
         av_frame_free(&this->pFrame);
     this->pFrame = nullptr;
+}
 
-    if (this->pFrameData)
-        free(this->pFrameData);
-    this->pFrameData = nullptr;
+bool FFMpegStream::IsOpen() const 
+{
+    return this->pFormatContext != nullptr;
+}
 
-    if (this->pTargetFrame) 
-        av_frame_free(&this->pTargetFrame);
-    this->pTargetFrame = nullptr;
+int FFMpegStream::ReadInput(void* pOpaque, uint8_t* pBuffer, int size)
+{
+    FFMpegStream*      pStream = (FFMpegStream*)pOpaque;
+    const StreamInput& input   = pStream->Input;
+
+    int64_t count;
+    if (input.pData) {
+        count = std::min<uint64_t>(size, input.size - std::min<uint64_t>(pStream->InputPosition, input.size));
+        ::memcpy(pBuffer, input.pData + pStream->InputPosition, count);
+    } else {
+        count = input.read(pBuffer, size);
+    }
 
-    if (this->pTargetFrameData)
-        free(this->pTargetFrameData);
-    this->pTargetFrameData = nullptr;
+    if (count < 0)
+        return AVERROR(EIO);
+    if (count == 0)
+        return AVERROR_EOF;
+
+    pStream->InputPosition += count;
+    return count;
 }
 
-bool FFMpegStream::IsOpen() const 
+int64_t FFMpegStream::SeekInput(void* pOpaque, int64_t offset, int whence)
 {
-    return this->pFormatContext != nullptr;
+    FFMpegStream*      pStream = (FFMpegStream*)pOpaque;
+    const StreamInput& input   = pStream->Input;
+
+    if (whence == AVSEEK_SIZE)
+        return input.size ? (int64_t)input.size : -1;
+
+    switch (whence & ~AVSEEK_FORCE) {
+        case SEEK_SET:
+            break;
+        case SEEK_CUR:
+            offset += pStream->InputPosition;
+            break;
+        case SEEK_END:
+            if (!input.size)
+                return -1;
+            offset += input.size;
+            break;
+        default:
+            return -1;
+    }
+
+    if (offset < 0 || (input.pData && (uint64_t)offset > input.size))
+        return -1;
+    if (!input.pData && !input.seek(offset))
+        return -1;
+
+    pStream->InputPosition = offset;
+    return offset;
 }
 
 bool FFMpegStream::GetNextFrame(Frame& frame, bool highQuality)
 {
-    int frameFinished = 0;
-    while(!frameFinished) {
-        AVPacket packet;
+    if (!this->HasPendingFrame && !this->DecodeNextFrame())
+        return false;
 
-        this->ResultCode = av_read_frame(this->pFormatContext, &packet);
-        if (this->ResultCode < 0)
-            return false;
+    this->HasPendingFrame = false;
+    this->frameNum ++;
+    return this->GetCurrentFrame(frame, highQuality);
+}
 
-        if (packet.stream_index != (int)this->VideoStreamIndex) {
-            av_free_packet(&packet);
-            continue;
-        }
+bool FFMpegStream::GetCurrentFrame(Frame& frame, bool highQuality)
+{
+    // nothing decoded since open or rewind
+    if (this->frameNum == 0)
+        return false;
 
-        avcodec_decode_video2(this->pVideoStreamCodecContext, this->pFrame, &frameFinished, &packet);
-        av_free_packet(&packet);
-    }
+    if (!highQuality)
+        return this->GetAnalysisFrame(frame);
+
+    // scale straight into the frame's (usually recycled) buffer
+    frame.Allocate(this->TargetWidth, this->TargetHeight);
+
+    uint8_t*    targetData[4]       = { frame.GetData(), nullptr, nullptr, nullptr };
+    int         targetLineSize[4]   = { (int)frame.GetStride(), 0, 0, 0 };
 
     sws_scale(
-        highQuality ? this->pSwsContextHQ : this->pSwsContextLQ, 
+        this->pSwsContextHQ, 
         this->pFrame->data, this->pFrame->linesize, 
         0, this->pVideoStreamCodecContext->height, 
-        this->pTargetFrame->data, this->pTargetFrame->linesize
+        targetData, targetLineSize
     );
 
-    frame = Frame(this->pTargetFrame->data[0], this->TargetWidth, this->TargetHeight, this->pTargetFrame->linesize[0]);
-    this->frameNum ++;
     return true;
 }
 
+bool FFMpegStream::GetAnalysisFrame(Frame& frame)
+{
+    size_t width  = this->pVideoStreamCodecContext->width;
+    size_t height = this->pVideoStreamCodecContext->height;
+    size_t analysisWidth, analysisHeight;
+    this->GetAnalysisSize(width, height, analysisWidth, analysisHeight);
+
+    frame.Allocate(analysisWidth, analysisHeight, PixelFormat::Gray);
+
+    // with 8 bit luma in a plane of its own only that plane is read and scaled,
+    // anything else goes through a full conversion to gray
+    AVPixelFormat               format  = (AVPixelFormat)this->pFrame->format;
+    const AVPixFmtDescriptor*   pDesc   = av_pix_fmt_desc_get(format);
+    const uint64_t              noLuma  = AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BAYER | AV_PIX_FMT_FLAG_HWACCEL;
+    if (pDesc && !(pDesc->flags & noLuma) && pDesc->comp[0].plane == 0 && pDesc->comp[0].step == 1 && pDesc->comp[0].offset == 0 && pDesc->comp[0].depth == 8)
+        format = AV_PIX_FMT_GRAY8;
+
+    // averaging keeps the metrics stable at these tiny sizes
+    this->pSwsContextLQ = sws_getCachedContext(
+        this->pSwsContextLQ,
+        width, height, format,
+        analysisWidth, analysisHeight, AV_PIX_FMT_GRAY8,
+        SWS_AREA, nullptr, nullptr, nullptr
+    );
+    if (!this->pSwsContextLQ)
+        return false;
+
+    uint8_t*    targetData[4]       = { frame.GetData(), nullptr, nullptr, nullptr };
+    int         targetLineSize[4]   = { (int)frame.GetStride(), 0, 0, 0 };
+
+    sws_scale(
+        this->pSwsContextLQ,
+        this->pFrame->data, this->pFrame->linesize,
+        0, height,
+        targetData, targetLineSize
+    );
+
+    return true;
+}
 
 bool FFMpegStream::SkipNextFrame()
 {
-    int frameFinished = 0;
-    while(!frameFinished) {
-        AVPacket packet;
+    if (!this->HasPendingFrame && !this->DecodeNextFrame())
+        return false;
+
+    this->HasPendingFrame = false;
+    this->frameNum ++;
+    return true;
+}
 
+bool FFMpegStream::ReadVideoPacket(AVPacket& packet)
+{
+    if (this->KeyFramesOnly && this->SeekKeyFrames && this->NextKeyFrame < this->KeyFrameTimeStamps.size()) {
+        // jump straight to the next key frame instead of reading the whole GOP
+        av_seek_frame(this->pFormatContext, this->VideoStreamIndex, this->KeyFrameTimeStamps[this->NextKeyFrame++], AVSEEK_FLAG_BACKWARD);
+    }
+
+    for (;;) {
         this->ResultCode = av_read_frame(this->pFormatContext, &packet);
         if (this->ResultCode < 0)
             return false;
 
-        if (packet.stream_index != (int)this->VideoStreamIndex) {
-            av_free_packet(&packet);
-            continue;
+        if (packet.stream_index == (int)this->VideoStreamIndex && 
+            (!this->KeyFramesOnly || (packet.flags & AV_PKT_FLAG_KEY)))
+            return true;
+
+        av_packet_unref(&packet);
+    }
+}
+
+// B-frames put the presentation time of a key frame after its decode time,
+// so read its packet to compare it with the time stamps of decoded frames
+int64_t FFMpegStream::GetKeyFrameTimeStamp(size_t keyFrame)
+{
+    int64_t& timeStamp = this->KeyFramePresentationTimeStamps[keyFrame];
+    if (timeStamp != AV_NOPTS_VALUE)
+        return timeStamp;
+
+    // leaves the read position at the key frame, callers seek afterwards
+    timeStamp = this->KeyFrameTimeStamps[keyFrame];
+    if (av_seek_frame(this->pFormatContext, this->VideoStreamIndex, this->KeyFrameTimeStamps[keyFrame], AVSEEK_FLAG_BACKWARD) < 0)
+        return timeStamp;
+
+    while (av_read_frame(this->pFormatContext, this->pPacket) >= 0) {
+        bool found = this->pPacket->stream_index == (int)this->VideoStreamIndex && (this->pPacket->flags & AV_PKT_FLAG_KEY);
+        if (found && this->pPacket->pts != AV_NOPTS_VALUE)
+            timeStamp = this->pPacket->pts;
+        av_packet_unref(this->pPacket);
+
+        if (found)
+            break;
+    }
+
+    return timeStamp;
+}
+
+// the first key frame presented at or, if after is set, after the time stamp,
+// looking up only the key frames the search passes
+size_t FFMpegStream::FindKeyFrame(int64_t timeStamp, bool after)
+{
+    size_t first = 0;
+    size_t end   = this->KeyFrameTimeStamps.size();
+    while (first < end) {
+        size_t  middle = first + (end - first) / 2;
+        int64_t keyFrameTimeStamp = this->GetKeyFrameTimeStamp(middle);
+        if (keyFrameTimeStamp < timeStamp || (after && keyFrameTimeStamp == timeStamp))
+            first = middle + 1;
+        else
+            end = middle;
+    }
+    return first;
+}
+
+bool FFMpegStream::DecodeFrame(AVFrame* pDecoded)
+{
+    for (;;) {
+        this->ResultCode = avcodec_receive_frame(this->pVideoStreamCodecContext, pDecoded);
+        if (this->ResultCode == 0) {
+            this->DecodedFrameCount++;
+            break;
+        }
+
+        // AVERROR_EOF once the decoder has been drained
+        if (this->ResultCode != AVERROR(EAGAIN))
+            return false;
+
+        if (this->ReadVideoPacket(*this->pPacket)) {
+            // broken packets are skipped, the decoder will resync on its own
+            avcodec_send_packet(this->pVideoStreamCodecContext, this->pPacket);
+            av_packet_unref(this->pPacket);
+        } else {
+            // end of input, flush the frames still buffered in the decoder threads
+            avcodec_send_packet(this->pVideoStreamCodecContext, nullptr);
+        }
+    }
+
+    return true;
+}
+
+bool FFMpegStream::DecodeNextFrame()
+{
+    for (;;) {
+        if (this->DecodeAheadFrames.empty()) {
+            if (!this->DecodeFrame(this->pFrame))
+                return false;
+        } else {
+            if (this->DecodeAheadDone)
+                return false;
+
+            if (!this->DecodeThread.joinable())
+                this->StartDecodeAhead();
+
+            AVFrame* pDecoded = this->DecodedFrames.Pop();
+            if (!pDecoded) {
+                // end of stream or error, ResultCode has been set by the thread
+                this->DecodeThread.join();
+                this->DecodeAheadDone = true;
+                return false;
+            }
+
+            // hand the previous frame back to the decode thread
+            av_frame_unref(this->pFrame);
+            this->FreeFrames.Push(this->pFrame);
+            this->pFrame = pDecoded;
         }
 
-        avcodec_decode_video2(this->pVideoStreamCodecContext, this->pFrame, &frameFinished, &packet);
-        av_free_packet(&packet);
+        this->FrameTimeStamp = av_frame_get_best_effort_timestamp(this->pFrame);
+
+        // frames of the previous segment, decoded on the way from its key frame
+        if (this->SegmentStart == AV_NOPTS_VALUE || this->FrameTimeStamp == AV_NOPTS_VALUE || this->FrameTimeStamp >= this->SegmentStart)
+            break;
     }
-    this->frameNum ++;
+
+    // the next segment takes over from here
+    if (this->SegmentEnd != AV_NOPTS_VALUE && this->FrameTimeStamp != AV_NOPTS_VALUE && this->FrameTimeStamp >= this->SegmentEnd)
+        return false;
+
+    if (this->FrameTimeStamp != AV_NOPTS_VALUE)
+        this->frameTime = (this->FrameTimeStamp - this->StartTime) * this->TimeBase;
+    else if (this->FrameRate > 0.0)
+        this->frameTime = this->frameNum / this->FrameRate;
+
+    // first time we see this frame
+    if (this->frameNum == this->frameIndex.size())
+        this->frameIndex.push_back({ this->FrameTimeStamp, this->pFrame->key_frame != 0 });
+
     return true;
 }
 
+void FFMpegStream::DecodeAhead()
+{
+    for (;;) {
+        // a null frame is sent by StopDecodeAhead to wake the thread up
+        AVFrame* pDecoded = this->FreeFrames.Pop();
+        if (!pDecoded || this->StopDecoding)
+            return;
+
+        if (!this->DecodeFrame(pDecoded)) {
+            this->DecodedFrames.Push(nullptr);
+            return;
+        }
+
+        this->DecodedFrames.Push(pDecoded);
+    }
+}
+
+void FFMpegStream::StartDecodeAhead()
+{
+    // every frame but the current one is free, the rings can hold all of them
+    this->FreeFrames.Reset(this->DecodeAheadFrames.size());
+    this->DecodedFrames.Reset(this->DecodeAheadFrames.size());
+
+    for (AVFrame* pDecoded : this->DecodeAheadFrames) {
+        if (pDecoded != this->pFrame) {
+            av_frame_unref(pDecoded);
+            this->FreeFrames.Push(pDecoded);
+        }
+    }
+
+    this->StopDecoding = false;
+    this->DecodeAheadDone = false;
+    this->DecodeThread = std::thread(&FFMpegStream::DecodeAhead, this);
+}
+
+void FFMpegStream::StopDecodeAhead()
+{
+    // frames decoded but not read yet are dropped, callers seek afterwards
+    if (this->DecodeThread.joinable()) {
+        // the current frame is never queued, so there is room for the null one
+        this->StopDecoding = true;
+        this->FreeFrames.TryPush(nullptr);
+        this->DecodeThread.join();
+    }
+    this->DecodeAheadDone = false;
+}
+
+void FFMpegStream::SetDecodeAhead(size_t depth)
+{
+    this->StopDecodeAhead();
+
+    for (AVFrame* pDecoded : this->DecodeAheadFrames) {
+        if (pDecoded != this->pFrame)
+            av_frame_free(&pDecoded);
+    }
+    this->DecodeAheadFrames.clear();
+
+    if (depth == 0 || !this->pFrame)
+        return;
+
+    // the current frame is part of the set, so one more than the depth
+    this->DecodeAheadFrames.push_back(this->pFrame);
+    while (this->DecodeAheadFrames.size() < depth + 1)
+        this->DecodeAheadFrames.push_back(av_frame_alloc());
+}
+
 void FFMpegStream::Rewind()
 {
-    avformat_seek_file(this->pFormatContext, this->VideoStreamIndex, 0,0,0, AVSEEK_FLAG_FRAME);
+    this->StopDecodeAhead();
+    if (this->SegmentStart != AV_NOPTS_VALUE)
+        av_seek_frame(this->pFormatContext, this->VideoStreamIndex, this->KeyFrameTimeStamps[this->SegmentKeyFrame], AVSEEK_FLAG_BACKWARD);
+    else
+        avformat_seek_file(this->pFormatContext, this->VideoStreamIndex, 0,0,0, AVSEEK_FLAG_FRAME);
+    avcodec_flush_buffers(this->pVideoStreamCodecContext);
     this->frameNum = 0;
+    this->frameTime = 0.0;
+    this->NextKeyFrame = this->SegmentKeyFrame;
+    this->HasPendingFrame = false;
+}
+
+bool FFMpegStream::SeekToFrame(size_t n)
+{
+    // frames not seen yet have to be reached by decoding
+    if (n >= this->frameIndex.size() || this->frameIndex[n].timeStamp == AV_NOPTS_VALUE)
+        return Stream::SeekToFrame(n);
+
+    size_t keyFrame = n;
+    while (keyFrame > 0 && !this->frameIndex[keyFrame].isKeyFrame)
+        keyFrame--;
+
+    // no key frame in between, just decode forward
+    if (n >= this->frameNum && keyFrame < this->frameNum)
+        return Stream::SeekToFrame(n);
+
+    this->StopDecodeAhead();
+    avcodec_flush_buffers(this->pVideoStreamCodecContext);
+    this->HasPendingFrame = false;
+
+    int64_t timeStamp = this->frameIndex[n].timeStamp;
+    if (this->KeyFramesOnly && this->SeekKeyFrames) {
+        // ReadVideoPacket seeks on its own, from the last key frame not after
+        // the frame, frame numbers need not match key frame numbers
+        size_t keyFrameEnd = this->FindKeyFrame(timeStamp, true);
+        this->NextKeyFrame = keyFrameEnd > 0 ? keyFrameEnd - 1 : 0;
+    } else {
+        this->ResultCode = av_seek_frame(this->pFormatContext, this->VideoStreamIndex, this->frameIndex[keyFrame].timeStamp, AVSEEK_FLAG_BACKWARD);
+        if (this->ResultCode < 0)
+            return false;
+    }
+
+    // frameNum stays below the index size so nothing is added to it
+    this->frameNum = n;
+
+    do {
+        if (!this->DecodeNextFrame())
+            return false;
+    } while (this->FrameTimeStamp == AV_NOPTS_VALUE || this->FrameTimeStamp < timeStamp);
+
+    // decoding went past the frame, whatever was found is not frame n
+    if (this->FrameTimeStamp != timeStamp)
+        return false;
+
+    this->HasPendingFrame = true;
+    return true;
+}
+
+bool FFMpegStream::SeekToTime(double time)
+{
+    int64_t timeStamp = this->StartTime + (int64_t)(time / this->TimeBase);
+
+    this->StopDecodeAhead();
+    avcodec_flush_buffers(this->pVideoStreamCodecContext);
+    this->HasPendingFrame = false;
+
+    if (this->KeyFramesOnly && this->SeekKeyFrames) {
+        // ReadVideoPacket seeks on its own, starting at the first key frame not before the time
+        this->NextKeyFrame = this->FindKeyFrame(timeStamp, false);
+    } else {
+        this->ResultCode = av_seek_frame(this->pFormatContext, this->VideoStreamIndex, timeStamp, AVSEEK_FLAG_BACKWARD);
+        if (this->ResultCode < 0)
+            return false;
+    }
+
+    // only the very first frame can be indexed with certainty
+    this->frameIndex.clear();
+    this->frameNum = this->FrameRate > 0.0 ? time * this->FrameRate : 0;
+
+    do {
+        if (!this->DecodeNextFrame())
+            return false;
+    } while (this->FrameTimeStamp != AV_NOPTS_VALUE && this->FrameTimeStamp < timeStamp);
+
+    this->HasPendingFrame = true;
+    return true;
+}
+
+void FFMpegStream::SetKeyFramesOnly(bool keyFramesOnly)
+{
+    this->KeyFramesOnly = keyFramesOnly;
+    this->pVideoStreamCodecContext->skip_frame = keyFramesOnly ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+
+    // without an index the number of key frames is unknown
+    this->totalFrameCount = keyFramesOnly ? this->KeyFrameTimeStamps.size() : this->FrameCountEstimate;
+}
+
+size_t FFMpegStream::GetSegmentCount(size_t maxCount) const
+{
+    // segments start at indexed key frames
+    return std::max<size_t>(1, std::min(maxCount, this->KeyFrameTimeStamps.size()));
+}
+
+bool FFMpegStream::SetSegment(size_t segment, size_t segmentCount)
+{
+    size_t keyFrameCount = this->KeyFrameTimeStamps.size();
+    if (segment >= segmentCount || (segmentCount > 1 && segmentCount > keyFrameCount))
+        return false;
+
+    if (segmentCount > 1) {
+        size_t first = segment * keyFrameCount / segmentCount;
+        size_t end   = (segment + 1) * keyFrameCount / segmentCount;
+
+        // the first segment also gets whatever comes before the first indexed
+        // key frame, the frames of a segment are those presented from its key
+        // frame on, as in one pass over the whole video
+        this->StopDecodeAhead();
+        this->SegmentKeyFrame = first;
+        this->SegmentStart    = segment > 0 ? this->GetKeyFrameTimeStamp(first) : AV_NOPTS_VALUE;
+        this->SegmentEnd      = end < keyFrameCount ? this->GetKeyFrameTimeStamp(end) : AV_NOPTS_VALUE;
+    } else {
+        this->SegmentKeyFrame = 0;
+        this->SegmentStart    = AV_NOPTS_VALUE;
+        this->SegmentEnd      = AV_NOPTS_VALUE;
+    }
+
+    // frame numbers and the index are local to the segment
+    this->frameIndex.clear();
+    this->Rewind();
+    return true;
 }
 
 }
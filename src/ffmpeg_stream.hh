@@ -1,9 +1,16 @@
 #pragma once
 
 #include "stream.hh"
+#include "ring_buffer.hh"
+
+#include <atomic>
+#include <thread>
+#include <vector>
 
 struct AVFormatContext;
+struct AVIOContext;
 struct AVCodecContext;
+struct AVPacket;
 struct AVFrame;
 struct SwsContext;
 
@@ -18,26 +25,85 @@ public:
     virtual             ~FFMpegStream();
 
     bool                GetNextFrame(Frame& frame, bool highQuality = false) override;
+    bool                GetCurrentFrame(Frame& frame, bool highQuality = false) override;
     bool                SkipNextFrame() override;
 
     void                Rewind() override;
 
+    bool                SeekToFrame(size_t n) override;
+    bool                SeekToTime(double time) override;
+    void                SetKeyFramesOnly(bool keyFramesOnly) override;
+    size_t              GetSegmentCount(size_t maxCount) const override;
+    bool                SetSegment(size_t segment, size_t segmentCount) override;
+    void                SetDecodeAhead(size_t depth) override;
+
 protected:
 
     int                 ResultCode;
     AVFormatContext*    pFormatContext;
+
+    // reads inputs that are not files, and the position in them
+    AVIOContext*        pIOContext;
+    uint64_t            InputPosition;
     size_t              VideoStreamIndex;
     AVCodecContext*     pVideoStreamCodecContext;
 
     AVFrame*            pFrame;
-    AVFrame*            pTargetFrame;
+    AVPacket*           pPacket;
 
     SwsContext*         pSwsContextLQ;
     SwsContext*         pSwsContextHQ;
 
-    bool                Open(const char *pFileName) override;
+    double              FrameRate;
+    double              TimeBase;
+    int64_t             StartTime;
+    size_t              FrameCountEstimate;
+
+    // key frame time stamps from the container index, if there is one, which
+    // are decode time stamps for some containers, and the presentation time
+    // stamps the frames come out with, AV_NOPTS_VALUE until looked up
+    std::vector<int64_t> KeyFrameTimeStamps;
+    std::vector<int64_t> KeyFramePresentationTimeStamps;
+    size_t              NextKeyFrame;
+    bool                SeekKeyFrames;
+    bool                KeyFramesOnly;
+
+    // presentation time stamps the current segment starts and ends at,
+    // AV_NOPTS_VALUE if open, and the index of its first key frame
+    int64_t             SegmentStart;
+    int64_t             SegmentEnd;
+    size_t              SegmentKeyFrame;
+
+    // raw time stamp of the last decoded frame
+    int64_t             FrameTimeStamp;
+    // the last decoded frame has not been returned yet
+    bool                HasPendingFrame;
+
+    // decode ahead thread and the frames passed between it and the reader
+    std::vector<AVFrame*> DecodeAheadFrames;
+    RingBuffer<AVFrame*> FreeFrames;
+    RingBuffer<AVFrame*> DecodedFrames;
+    std::thread         DecodeThread;
+    std::atomic<bool>   StopDecoding;
+    bool                DecodeAheadDone;
+
+    bool                Open(const StreamInput& input) override;
     void                Close();
     bool                IsOpen() const;
+
+    bool                ReadVideoPacket(AVPacket& packet);
+    int64_t             GetKeyFrameTimeStamp(size_t keyFrame);
+    size_t              FindKeyFrame(int64_t timeStamp, bool after);
+    bool                DecodeFrame(AVFrame* pDecoded);
+    bool                DecodeNextFrame();
+    bool                GetAnalysisFrame(Frame& frame);
+
+    static int          ReadInput(void* pOpaque, uint8_t* pBuffer, int size);
+    static int64_t      SeekInput(void* pOpaque, int64_t offset, int whence);
+
+    void                DecodeAhead();
+    void                StartDecodeAhead();
+    void                StopDecodeAhead();
 };
 
 }
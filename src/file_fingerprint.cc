@@ -0,0 +1,44 @@
+#include "file_fingerprint.hh"
+
+#include <cstdio>
+#include <vector>
+
+#include <sys/stat.h>
+#include <zlib.h>
+
+namespace vidthumb {
+
+// bytes hashed at the start and at the end of each file
+static const size_t FingerprintBlockSize = 64 * 1024;
+
+bool GetFileFingerprint(const char *pFileName, FileFingerprint& fingerprint)
+{
+    struct stat fileStat;
+    if (stat(pFileName, &fileStat) != 0)
+        return false;
+
+    fingerprint.size             = fileStat.st_size;
+    fingerprint.modificationTime = fileStat.st_mtime;
+
+    FILE* pFile = fopen(pFileName, "rb");
+    if (!pFile)
+        return false;
+
+    std::vector<uint8_t> block(FingerprintBlockSize);
+    uLong crc = crc32(0, nullptr, 0);
+
+    size_t length = fread(block.data(), 1, block.size(), pFile);
+    crc = crc32(crc, block.data(), length);
+
+    if (fingerprint.size > 2 * FingerprintBlockSize && fseeko(pFile, -(off_t)FingerprintBlockSize, SEEK_END) == 0) {
+        length = fread(block.data(), 1, block.size(), pFile);
+        crc = crc32(crc, block.data(), length);
+    }
+
+    fclose(pFile);
+
+    fingerprint.checksum = crc;
+    return true;
+}
+
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+
+namespace vidthumb 
+{
+
+// Cheap identity of a file's contents: its size and modification time plus a
+// checksum of the first and last 64 KiB, which catches rewritten files that
+// kept both.
+struct FileFingerprint
+{
+    uint64_t            size;
+    int64_t             modificationTime;
+    uint32_t            checksum;
+
+    bool                operator==(const FileFingerprint& other) const 
+    {
+        return this->size == other.size && this->modificationTime == other.modificationTime && this->checksum == other.checksum;
+    }
+};
+
+bool GetFileFingerprint(const char *pFileName, FileFingerprint& fingerprint);
+
+}
@@ -1,111 +1,175 @@
 #include "frame.hh"
+#include "frame_buffer_pool.hh"
+#include "frame_kernels.hh"
 
 #include <cairo/cairo.h>
 #include <cstdlib>
 #include <cstring>
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <iostream>
+#include <utility>
 
 namespace vidthumb {
 
-static inline float PixelDiff(const uint8_t* pRGB1, const uint8_t* pRGB2)
+// rows are aligned for the SIMD paths of swscale, which cairo accepts as well
+static size_t GetFrameStride(size_t width, PixelFormat format)
 {
-    float diff = 0.0f;
-    for (int i=0; i<3; i++) {
-        float d = (pRGB1[i]-pRGB2[i])/255.0f;
-        diff += d*d;
-    }
-    return diff;
+    size_t stride = format == PixelFormat::Gray ? width : cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, width);
+    return (stride + 31) & ~(size_t)31;
 }
 
 Frame::Frame() :
-    pData   { nullptr },
-    Width   { 0 },
-    Height  { 0 },
-    Stride  { 0 }
+    pData       { nullptr },
+    Width       { 0 },
+    Height      { 0 },
+    Stride      { 0 },
+    Format      { PixelFormat::RGB },
+    OwnsData    { false }
 {
 }
 
+Frame::Frame(size_t width, size_t height, PixelFormat format) :
+    Frame()
+{
+    this->Allocate(width, height, format);
+}
+
 Frame::Frame(const uint8_t *pPixels, size_t width, size_t height, size_t lineStride) :
-    pData   { nullptr },
-    Width   { width },
-    Height  { height },
-    Stride  { 0 }
+    Frame()
 {
-    this->Stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, width);
-    this->pData = (uint8_t*)aligned_alloc(32, height * this->Stride);
+    this->Allocate(width, height);
 
     for (size_t y=0; y<height; y++) { 
         memcpy(this->pData + y*this->Stride, pPixels + y*lineStride, width*4);
     }
 }
 
-Frame& Frame::operator=(const Frame& rhs)
+Frame::Frame(const Frame& other) :
+    Frame()
 {
-    if (this->pData)
-        free(this->pData);
+    *this = other;
+}
+
+Frame::Frame(Frame&& other) noexcept :
+    Frame()
+{
+    *this = std::move(other);
+}
 
-    this->pData = (uint8_t*)aligned_alloc(32, rhs.Height * rhs.Stride);
-    ::memcpy(this->pData, rhs.pData, rhs.Height * rhs.Stride);
+Frame Frame::View(uint8_t *pPixels, size_t width, size_t height, size_t lineStride, PixelFormat format)
+{
+    Frame frame;
+    frame.pData  = pPixels;
+    frame.Width  = width;
+    frame.Height = height;
+    frame.Stride = lineStride;
+    frame.Format = format;
+    return frame;
+}
 
-    this->Width = rhs.Width;
-    this->Height = rhs.Height;
-    this->Stride = rhs.Stride;
+void Frame::Allocate(size_t width, size_t height, PixelFormat format)
+{
+    // keep the buffer, or keep writing into the viewed pixels
+    if (this->pData && this->Width == width && this->Height == height && this->Format == format)
+        return;
+
+    this->Release();
+
+    this->Width    = width;
+    this->Height   = height;
+    this->Format   = format;
+    this->Stride   = GetFrameStride(width, format);
+    this->pData    = FrameBufferPool::GetDefault().Acquire(height * this->Stride);
+    this->OwnsData = true;
+}
 
-    return *this;
+void Frame::Release()
+{
+    if (this->OwnsData)
+        FrameBufferPool::GetDefault().Release(this->pData, this->Height * this->Stride);
+
+    this->pData    = nullptr;
+    this->Width    = 0;
+    this->Height   = 0;
+    this->Stride   = 0;
+    this->Format   = PixelFormat::RGB;
+    this->OwnsData = false;
 }
 
-Frame& Frame::operator=(Frame&& rhs)
+Frame& Frame::operator=(const Frame& rhs)
 {
-    if (this->pData)
-        free(this->pData);
+    if (this == &rhs)
+        return *this;
+
+    if (!rhs.pData) {
+        this->Release();
+        return *this;
+    }
 
-    this->pData = rhs.pData;
-    this->Width = rhs.Width;
-    this->Height = rhs.Height;
-    this->Stride = rhs.Stride;
+    this->Allocate(rhs.Width, rhs.Height, rhs.Format);
+
+    for (size_t y=0; y<this->Height; y++) { 
+        memcpy(this->pData + y*this->Stride, rhs.pData + y*rhs.Stride, this->Width*this->GetBytesPerPixel());
+    }
 
-    rhs.pData = nullptr;
-    rhs.Width = 0;
-    rhs.Height = 0;
-    rhs.Stride = 0;
+    return *this;
+}
+
+Frame& Frame::operator=(Frame&& rhs) noexcept
+{
+    if (this == &rhs)
+        return *this;
+
+    // a view is written through instead of being replaced
+    if (this->pData && !this->OwnsData)
+        return *this = static_cast<const Frame&>(rhs);
+
+    this->Release();
+
+    this->pData    = rhs.pData;
+    this->Width    = rhs.Width;
+    this->Height   = rhs.Height;
+    this->Stride   = rhs.Stride;
+    this->Format   = rhs.Format;
+    this->OwnsData = rhs.OwnsData;
+
+    rhs.pData    = nullptr;
+    rhs.Width    = 0;
+    rhs.Height   = 0;
+    rhs.Stride   = 0;
+    rhs.Format   = PixelFormat::RGB;
+    rhs.OwnsData = false;
     return *this;
 }
 
 Frame::~Frame()
 {
-    if (this->pData)
-        free(this->pData);
+    this->Release();
 }
 
-float Frame::GetDifference(const Frame* pOther)
+float Frame::GetDifference(const Frame* pOther) const
 {
     assert(this->pData != nullptr);
     assert(pOther->pData != nullptr);
 
-    if (this->Width != pOther->Width || this->Height != pOther->Height)
+    if (this->Width != pOther->Width || this->Height != pOther->Height || this->Format != pOther->Format)
         return -1.0f;
 
     if (this->pData == nullptr || pOther->pData == nullptr) {
         return 0.0f;
     }
 
-    float diff = 0;
+    bool     gray     = this->Format == PixelFormat::Gray;
+    uint64_t diff     = 0;
     for (size_t y=0; y<this->Height; y++) {
-        for (size_t x=0; x<this->Width*4; x+=4) {
-            diff += PixelDiff( this->pData + x+y*this->Stride, pOther->pData + x+y*pOther->Stride );
-            /*
-            float yThis = 0.299 * rgbThis[0] + 0.587 * rgbThis[1] + 0.114 * rgbThis[2];
-            float yThat = 0.299 * rgbThat[0] + 0.587 * rgbThat[1] + 0.114 * rgbThat[2];
-
-            float yDiff = std::abs(yThat-yThis);
-            diff += yDiff;
-            */
-        }
+        const uint8_t* pRow1 = this->pData + y*this->Stride;
+        const uint8_t* pRow2 = pOther->pData + y*pOther->Stride;
+        diff += gray ? SumSquaredDifferencesGray(pRow1, pRow2, this->Width) : SumSquaredDifferences(pRow1, pRow2, this->Width);
     }
 
-    return std::sqrt(diff) / std::sqrt((float)(this->Width * this->Height * 3));
+    return std::sqrt((double)diff) / 255.0 / std::sqrt((double)(this->Width * this->Height * (gray ? 1 : 3)));
 }
 
 float Frame::GetContrast() const
@@ -116,68 +180,21 @@ float Frame::GetContrast() const
         return 0.0f;
     }
 
-    float mean = 0.0f;
-    float variance = 0.0f;
-
-    size_t y;
-
-    #pragma omp parallel for default(shared) private(y) reduction(+:mean)
-    for (y=0; y<this->Height; y++) {
-        float lineMean = 0.0f;
-        for (size_t x=0; x<this->Width*4; x+=4) {
-            float val = 0.299f * this->pData[x+y*this->Stride + 0] +
-                        0.587f * this->pData[x+y*this->Stride + 1] +
-                        0.114f * this->pData[x+y*this->Stride + 2] ;
-    
-            val      /= 255.0f;
-            lineMean     += val;
-        }
-        mean += lineMean; 
-
-    }
-
-    mean /= (float)(this->Width * this->Height);
-
-    #pragma omp parallel for default(shared) private(y) reduction(+:variance)
-    for (y=0; y<this->Height; y++) {
-        float lineVar = 0.0;
-        for (size_t x=0; x<this->Width*4; x+=4) {
-            float val = 0.299f * this->pData[x+y*this->Stride + 0] +
-                        0.587f * this->pData[x+y*this->Stride + 1] +
-                        0.114f * this->pData[x+y*this->Stride + 2] ;
-            val      /= 255.0f;
-            lineVar += (val-mean) * (val-mean);
-        }
-        variance += lineVar;
-    }
-
-    variance /= (float)(this->Width * this->Height - 1);
-
-    //std::cerr << "light: " << lightValue << " dark: " << darkValue << " contrast: " << std::abs( lightValue - darkValue ) / std::max( lightValue, darkValue ) << std::endl;
-    //std::cerr << "variance: " << variance << " stddev: " << std::sqrt(variance) << std::endl;
-    return std::sqrt(variance);
-
-/*
-    float lightValue = 0.0f;
-    float midValue   = 0.0f;
-    float darkValue  = 0.0f;
-
-    float histogram[16] = { 0.0f };
-
+    // single pass over the luma, variance from sum and sum of squares
+    uint64_t sum        = 0;
+    uint64_t sumSquares = 0;
     for (size_t y=0; y<this->Height; y++) {
-        for (size_t x=0; x<this->Width*4; x+=4) {
-            float val = 0.299f * this->pData[x+y*this->Stride + 0] +
-                        0.587f * this->pData[x+y*this->Stride + 1] +
-                        0.114f * this->pData[x+y*this->Stride + 2] ;
-    
-            size_t index = 15 * val;
-            histogram[index] ++;
-        }
+        if (this->Format == PixelFormat::Gray)
+            SumGray(this->pData + y*this->Stride, this->Width, sum, sumSquares);
+        else
+            SumLuma(this->pData + y*this->Stride, this->Width, sum, sumSquares);
     }
-*/
 
+    double count    = (double)(this->Width * this->Height);
+    double mean     = sum / count;
+    double variance = (sumSquares - sum * mean) / std::max(count - 1.0, 1.0);
 
-    //return std::abs( lightValue - darkValue ) / std::max( lightValue, darkValue );  
+    return std::sqrt(std::max(variance, 0.0)) / 255.0;
 }
 
 void Frame::Save(const char *pFileName) const 
@@ -192,6 +209,7 @@ void Frame::Save(const char *pFileName) const
 
 void* Frame::CreateCairoSurface() const
 {
+    assert(this->Format == PixelFormat::RGB);
     return cairo_image_surface_create_for_data(this->pData, CAIRO_FORMAT_RGB24, this->Width, this->Height, this->Stride);
 }
 
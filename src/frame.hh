@@ -5,21 +5,44 @@
 
 namespace vidthumb {
 
+// RGB frames hold 32 bit pixels as cairo expects them, gray frames a single
+// luma byte per pixel and are only used for analysis
+enum class PixelFormat
+{
+    RGB,
+    Gray
+};
+
 class Frame
 {
 public:
 
     Frame();
+    Frame(size_t width, size_t height, PixelFormat format = PixelFormat::RGB);
     Frame(const uint8_t *pPixels, size_t width, size_t height, size_t lineStride);
+    Frame(const Frame& other);
+    Frame(Frame&& other) noexcept;
     ~Frame();
 
     Frame& operator=(const Frame& rhs);
-    Frame& operator=(Frame&& rhs);
+    Frame& operator=(Frame&& rhs) noexcept;
+
+    // non-owning frame on top of existing pixels, which are written to on assignment
+    static Frame View(uint8_t *pPixels, size_t width, size_t height, size_t lineStride, PixelFormat format = PixelFormat::RGB);
+
+    // make room for the given size, reusing the current buffer if it fits
+    void Allocate(size_t width, size_t height, PixelFormat format = PixelFormat::RGB);
 
     size_t GetWidth() const { return this->Width; }
     size_t GetHeight() const { return this->Height; }
+    size_t GetStride() const { return this->Stride; }
+    PixelFormat GetFormat() const { return this->Format; }
+    size_t GetBytesPerPixel() const { return this->Format == PixelFormat::Gray ? 1 : 4; }
+
+    uint8_t* GetData() { return this->pData; }
+    const uint8_t* GetData() const { return this->pData; }
 
-    float GetDifference(const Frame* other);
+    float GetDifference(const Frame* other) const;
     float GetContrast() const;
 
     void Save(const char *pFileName) const;
@@ -32,6 +55,10 @@ private:
     size_t      Width;
     size_t      Height;
     size_t      Stride;
+    PixelFormat Format;
+    bool        OwnsData;
+
+    void Release();
 };
 
 }
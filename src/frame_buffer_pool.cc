@@ -0,0 +1,59 @@
+#include "frame_buffer_pool.hh"
+
+#include <cstdlib>
+
+namespace vidthumb {
+
+// upper limit for memory kept around for reuse
+static const size_t MaxFreeBytes = 256 << 20;
+
+FrameBufferPool& FrameBufferPool::GetDefault()
+{
+    static FrameBufferPool pool;
+    return pool;
+}
+
+FrameBufferPool::~FrameBufferPool()
+{
+    for (auto& buffer : this->FreeBuffers)
+        free(buffer.second);
+}
+
+uint8_t* FrameBufferPool::Acquire(size_t size)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+
+        for (auto it = this->FreeBuffers.begin(); it != this->FreeBuffers.end(); it++) {
+            if (it->first == size) {
+                uint8_t* pBuffer = it->second;
+                this->FreeBytes -= size;
+                this->FreeBuffers.erase(it);
+                return pBuffer;
+            }
+        }
+    }
+
+    // aligned_alloc wants a multiple of the alignment
+    return (uint8_t*)aligned_alloc(32, (size + 31) & ~(size_t)31);
+}
+
+void FrameBufferPool::Release(uint8_t* pBuffer, size_t size)
+{
+    if (!pBuffer)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+
+        if (this->FreeBytes + size <= MaxFreeBytes) {
+            this->FreeBuffers.emplace_back(size, pBuffer);
+            this->FreeBytes += size;
+            return;
+        }
+    }
+
+    free(pBuffer);
+}
+
+}
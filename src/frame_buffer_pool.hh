@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace vidthumb {
+
+// Recycles frame pixel buffers, so frames of the same size don't hit the allocator.
+class FrameBufferPool
+{
+public:
+
+    static FrameBufferPool& GetDefault();
+
+    ~FrameBufferPool();
+
+    uint8_t*    Acquire(size_t size);
+    void        Release(uint8_t* pBuffer, size_t size);
+
+private:
+
+    std::mutex  Mutex;
+    std::vector<std::pair<size_t, uint8_t*>> FreeBuffers;
+    size_t      FreeBytes = 0;
+};
+
+}
@@ -0,0 +1,518 @@
+#include "frame_kernels.hh"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VIDTHUMB_X86 1
+#include <immintrin.h>
+#endif
+
+namespace vidthumb {
+
+// luma weights in 1/256, in byte order of the pixels
+static const int LumaWeight0 = 77;
+static const int LumaWeight1 = 150;
+static const int LumaWeight2 = 29;
+
+// 32 bit accumulators are flushed after this many vectors so they can't overflow
+static const size_t BlockSize = 4096;
+
+static inline uint32_t Luma(const uint8_t* pPixel)
+{
+    return (LumaWeight0 * pPixel[0] + LumaWeight1 * pPixel[1] + LumaWeight2 * pPixel[2] + 128) >> 8;
+}
+
+uint64_t SumSquaredDifferencesScalar(const uint8_t* pRow1, const uint8_t* pRow2, size_t pixels)
+{
+    uint64_t sum = 0;
+    for (size_t x=0; x<pixels*4; x+=4) {
+        for (int i=0; i<3; i++) {
+            int d = pRow1[x+i] - pRow2[x+i];
+            sum += d*d;
+        }
+    }
+    return sum;
+}
+
+void SumLumaScalar(const uint8_t* pRow, size_t pixels, uint64_t& sum, uint64_t& sumSquares)
+{
+    for (size_t x=0; x<pixels*4; x+=4) {
+        uint32_t y = Luma(pRow + x);
+        sum        += y;
+        sumSquares += y*y;
+    }
+}
+
+uint64_t SumSquaredDifferencesGrayScalar(const uint8_t* pRow1, const uint8_t* pRow2, size_t pixels)
+{
+    uint64_t sum = 0;
+    for (size_t x=0; x<pixels; x++) {
+        int d = pRow1[x] - pRow2[x];
+        sum += d*d;
+    }
+    return sum;
+}
+
+void SumGrayScalar(const uint8_t* pRow, size_t pixels, uint64_t& sum, uint64_t& sumSquares)
+{
+    for (size_t x=0; x<pixels; x++) {
+        uint32_t y = pRow[x];
+        sum        += y;
+        sumSquares += y*y;
+    }
+}
+
+#ifdef VIDTHUMB_X86
+
+__attribute__((target("sse2")))
+static inline uint64_t HorizontalSum(__m128i v)
+{
+    alignas(16) uint32_t lanes[4];
+    _mm_store_si128((__m128i*)lanes, v);
+    return (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("sse2")))
+static uint64_t SumSquaredDifferencesSSE2(const uint8_t* pRow1, const uint8_t* pRow2, size_t pixels)
+{
+    const __m128i mask = _mm_set1_epi32(0x00ffffff);
+    const __m128i zero = _mm_setzero_si128();
+
+    uint64_t sum = 0;
+    size_t   x   = 0;
+
+    while (x + 4 <= pixels) {
+        __m128i acc = zero;
+        for (size_t n=0; n<BlockSize && x + 4 <= pixels; n++, x+=4) {
+            __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pRow1 + x*4)), mask);
+            __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pRow2 + x*4)), mask);
+            __m128i d = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+
+            __m128i lo = _mm_unpacklo_epi8(d, zero);
+            __m128i hi = _mm_unpackhi_epi8(d, zero);
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, lo));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, hi));
+        }
+        sum += HorizontalSum(acc);
+    }
+
+    return sum + SumSquaredDifferencesScalar(pRow1 + x*4, pRow2 + x*4, pixels - x);
+}
+
+__attribute__((target("sse2")))
+static void SumLumaSSE2(const uint8_t* pRow, size_t pixels, uint64_t& sum, uint64_t& sumSquares)
+{
+    const __m128i mask    = _mm_set1_epi32(0x00ffffff);
+    const __m128i zero    = _mm_setzero_si128();
+    const __m128i round   = _mm_set1_epi32(128);
+    const __m128i weights = _mm_setr_epi16(LumaWeight0, LumaWeight1, LumaWeight2, 0, LumaWeight0, LumaWeight1, LumaWeight2, 0);
+
+    uint64_t lumaSum    = 0;
+    uint64_t lumaSquare = 0;
+    size_t   x          = 0;
+
+    while (x + 4 <= pixels) {
+        __m128i accSum    = zero;
+        __m128i accSquare = zero;
+        for (size_t n=0; n<BlockSize && x + 4 <= pixels; n++, x+=4) {
+            __m128i p  = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pRow + x*4)), mask);
+
+            // two partial sums per pixel, adding the swapped pair leaves the
+            // luma of each pixel in two neighbouring lanes
+            __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(p, zero), weights);
+            __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(p, zero), weights);
+            lo = _mm_add_epi32(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2,3,0,1)));
+            hi = _mm_add_epi32(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2,3,0,1)));
+            lo = _mm_srli_epi32(_mm_add_epi32(lo, round), 8);
+            hi = _mm_srli_epi32(_mm_add_epi32(hi, round), 8);
+
+            accSum    = _mm_add_epi32(accSum, _mm_add_epi32(lo, hi));
+            accSquare = _mm_add_epi32(accSquare, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+        }
+        lumaSum    += HorizontalSum(accSum);
+        lumaSquare += HorizontalSum(accSquare);
+    }
+
+    // every pixel has been counted twice
+    sum        += lumaSum / 2;
+    sumSquares += lumaSquare / 2;
+
+    SumLumaScalar(pRow + x*4, pixels - x, sum, sumSquares);
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t HorizontalSumAVX2(__m256i v)
+{
+    alignas(32) uint32_t lanes[8];
+    _mm256_store_si256((__m256i*)lanes, v);
+
+    uint64_t sum = 0;
+    for (int i=0; i<8; i++)
+        sum += lanes[i];
+    return sum;
+}
+
+__attribute__((target("avx2")))
+static uint64_t SumSquaredDifferencesAVX2(const uint8_t* pRow1, const uint8_t* pRow2, size_t pixels)
+{
+    const __m256i mask = _mm256_set1_epi32(0x00ffffff);
+    const __m256i zero = _mm256_setzero_si256();
+
+    uint64_t sum = 0;
+    size_t   x   = 0;
+
+    while (x + 8 <= pixels) {
+        __m256i acc = zero;
+        for (size_t n=0; n<BlockSize && x + 8 <= pixels; n++, x+=8) {
+            __m256i a = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(pRow1 + x*4)), mask);
+            __m256i b = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(pRow2 + x*4)), mask);
+            __m256i d = _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+
+            __m256i lo = _mm256_unpacklo_epi8(d, zero);
+            __m256i hi = _mm256_unpackhi_epi8(d, zero);
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(lo, lo));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(hi, hi));
+        }
+        sum += HorizontalSumAVX2(acc);
+    }
+
+    return sum + SumSquaredDifferencesSSE2(pRow1 + x*4, pRow2 + x*4, pixels - x);
+}
+
+__attribute__((target("avx2")))
+static void SumLumaAVX2(const uint8_t* pRow, size_t pixels, uint64_t& sum, uint64_t& sumSquares)
+{
+    const __m256i mask    = _mm256_set1_epi32(0x00ffffff);
+    const __m256i zero    = _mm256_setzero_si256();
+    const __m256i round   = _mm256_set1_epi32(128);
+    const __m256i weights = _mm256_setr_epi16(
+        LumaWeight0, LumaWeight1, LumaWeight2, 0, LumaWeight0, LumaWeight1, LumaWeight2, 0,
+        LumaWeight0, LumaWeight1, LumaWeight2, 0, LumaWeight0, LumaWeight1, LumaWeight2, 0
+    );
+
+    uint64_t lumaSum    = 0;
+    uint64_t lumaSquare = 0;
+    size_t   x          = 0;
+
+    while (x + 8 <= pixels) {
+        __m256i accSum    = zero;
+        __m256i accSquare = zero;
+        for (size_t n=0; n<BlockSize && x + 8 <= pixels; n++, x+=8) {
+            __m256i p  = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(pRow + x*4)), mask);
+
+            __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(p, zero), weights);
+            __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(p, zero), weights);
+            lo = _mm256_add_epi32(lo, _mm256_shuffle_epi32(lo, _MM_SHUFFLE(2,3,0,1)));
+            hi = _mm256_add_epi32(hi, _mm256_shuffle_epi32(hi, _MM_SHUFFLE(2,3,0,1)));
+            lo = _mm256_srli_epi32(_mm256_add_epi32(lo, round), 8);
+            hi = _mm256_srli_epi32(_mm256_add_epi32(hi, round), 8);
+
+            accSum    = _mm256_add_epi32(accSum, _mm256_add_epi32(lo, hi));
+            accSquare = _mm256_add_epi32(accSquare, _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi)));
+        }
+        lumaSum    += HorizontalSumAVX2(accSum);
+        lumaSquare += HorizontalSumAVX2(accSquare);
+    }
+
+    sum        += lumaSum / 2;
+    sumSquares += lumaSquare / 2;
+
+    SumLumaSSE2(pRow + x*4, pixels - x, sum, sumSquares);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline uint64_t HorizontalSumAVX512(__m512i v)
+{
+    alignas(64) uint32_t lanes[16];
+    _mm512_store_si512((void*)lanes, v);
+
+    uint64_t sum = 0;
+    for (int i=0; i<16; i++)
+        sum += lanes[i];
+    return sum;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static uint64_t SumSquaredDifferencesAVX512(const uint8_t* pRow1, const uint8_t* pRow2, size_t pixels)
+{
+    const __m512i mask = _mm512_set1_epi32(0x00ffffff);
+    const __m512i zero = _mm512_setzero_si512();
+
+    uint64_t sum = 0;
+    size_t   x   = 0;
+
+    while (x + 16 <= pixels) {
+        __m512i acc = zero;
+        for (size_t n=0; n<BlockSize && x + 16 <= pixels; n++, x+=16) {
+            __m512i a = _mm512_and_si512(_mm512_loadu_si512((const void*)(pRow1 + x*4)), mask);
+            __m512i b = _mm512_and_si512(_mm512_loadu_si512((const void*)(pRow2 + x*4)), mask);
+            __m512i d = _mm512_or_si512(_mm512_subs_epu8(a, b), _mm512_subs_epu8(b, a));
+
+            __m512i lo = _mm512_unpacklo_epi8(d, zero);
+            __m512i hi = _mm512_unpackhi_epi8(d, zero);
+            acc = _mm512_add_epi32(acc, _mm512_madd_epi16(lo, lo));
+            acc = _mm512_add_epi32(acc, _mm512_madd_epi16(hi, hi));
+        }
+        sum += HorizontalSumAVX512(acc);
+    }
+
+    return sum + SumSquaredDifferencesAVX2(pRow1 + x*4, pRow2 + x*4, pixels - x);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void SumLumaAVX512(const uint8_t* pRow, size_t pixels, uint64_t& sum, uint64_t& sumSquares)
+{
+    const __m512i mask    = _mm512_set1_epi32(0x00ffffff);
+    const __m512i zero    = _mm512_setzero_si512();
+    const __m512i round   = _mm512_set1_epi32(128);
+    const __m512i weights = _mm512_set1_epi64(
+        ((int64_t)LumaWeight2 << 32) | ((int64_t)LumaWeight1 << 16) | LumaWeight0
+    );
+
+    uint64_t lumaSum    = 0;
+    uint64_t lumaSquare = 0;
+    size_t   x          = 0;
+
+    while (x + 16 <= pixels) {
+        __m512i accSum    = zero;
+        __m512i accSquare = zero;
+        for (size_t n=0; n<BlockSize && x + 16 <= pixels; n++, x+=16) {
+            __m512i p  = _mm512_and_si512(_mm512_loadu_si512((const void*)(pRow + x*4)), mask);
+
+            __m512i lo = _mm512_madd_epi16(_mm512_unpacklo_epi8(p, zero), weights);
+            __m512i hi = _mm512_madd_epi16(_mm512_unpackhi_epi8(p, zero), weights);
+            // the zero masked forms, the plain ones trip -Wmaybe-uninitialized in some GCCs
+            lo = _mm512_add_epi32(lo, _mm512_maskz_shuffle_epi32(0xffff, lo, (_MM_PERM_ENUM)_MM_SHUFFLE(2,3,0,1)));
+            hi = _mm512_add_epi32(hi, _mm512_maskz_shuffle_epi32(0xffff, hi, (_MM_PERM_ENUM)_MM_SHUFFLE(2,3,0,1)));
+            lo = _mm512_maskz_srli_epi32(0xffff, _mm512_add_epi32(lo, round), 8);
+            hi = _mm512_maskz_srli_epi32(0xffff, _mm512_add_epi32(hi, round), 8);
+
+            accSum    = _mm512_add_epi32(accSum, _mm512_add_epi32(lo, hi));
+            accSquare = _mm512_add_epi32(accSquare, _mm512_add_epi32(_mm512_madd_epi16(lo, lo), _mm512_madd_epi16(hi, hi)));
+        }
+        lumaSum    += HorizontalSumAVX512(accSum);
+        lumaSquare += HorizontalSumAVX512(accSquare);
+    }
+
+    sum        += lumaSum / 2;
+    sumSquares += lumaSquare / 2;
+
+    SumLumaAVX2(pRow + x*4, pixels - x, sum, sumSquares);
+}
+
+// gray rows, 16 pixels per 128 bit vector
+
+__attribute__((target("sse2")))
+static uint64_t SumSquaredDifferencesGraySSE2(const uint8_t* pRow1, const uint8_t* pRow2, size_t pixels)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    uint64_t sum = 0;
+    size_t   x   = 0;
+
+    while (x + 16 <= pixels) {
+        __m128i acc = zero;
+        for (size_t n=0; n<BlockSize && x + 16 <= pixels; n++, x+=16) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(pRow1 + x));
+            __m128i b = _mm_loadu_si128((const __m128i*)(pRow2 + x));
+            __m128i d = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+
+            __m128i lo = _mm_unpacklo_epi8(d, zero);
+            __m128i hi = _mm_unpackhi_epi8(d, zero);
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, lo));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, hi));
+        }
+        sum += HorizontalSum(acc);
+    }
+
+    return sum + SumSquaredDifferencesGrayScalar(pRow1 + x, pRow2 + x, pixels - x);
+}
+
+__attribute__((target("sse2")))
+static void SumGraySSE2(const uint8_t* pRow, size_t pixels, uint64_t& sum, uint64_t& sumSquares)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t x = 0;
+
+    while (x + 16 <= pixels) {
+        // psadbw against zero sums into 64 bit lanes, only the squares need flushing
+        __m128i accSum    = zero;
+        __m128i accSquare = zero;
+        for (size_t n=0; n<BlockSize && x + 16 <= pixels; n++, x+=16) {
+            __m128i p  = _mm_loadu_si128((const __m128i*)(pRow + x));
+            __m128i lo = _mm_unpacklo_epi8(p, zero);
+            __m128i hi = _mm_unpackhi_epi8(p, zero);
+
+            accSum    = _mm_add_epi64(accSum, _mm_sad_epu8(p, zero));
+            accSquare = _mm_add_epi32(accSquare, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+        }
+
+        alignas(16) uint64_t sums[2];
+        _mm_store_si128((__m128i*)sums, accSum);
+        sum        += sums[0] + sums[1];
+        sumSquares += HorizontalSum(accSquare);
+    }
+
+    SumGrayScalar(pRow + x, pixels - x, sum, sumSquares);
+}
+
+__attribute__((target("avx2")))
+static uint64_t SumSquaredDifferencesGrayAVX2(const uint8_t* pRow1, const uint8_t* pRow2, size_t pixels)
+{
+    const __m256i zero = _mm256_setzero_si256();
+
+    uint64_t sum = 0;
+    size_t   x   = 0;
+
+    while (x + 32 <= pixels) {
+        __m256i acc = zero;
+        for (size_t n=0; n<BlockSize && x + 32 <= pixels; n++, x+=32) {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(pRow1 + x));
+            __m256i b = _mm256_loadu_si256((const __m256i*)(pRow2 + x));
+            __m256i d = _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+
+            __m256i lo = _mm256_unpacklo_epi8(d, zero);
+            __m256i hi = _mm256_unpackhi_epi8(d, zero);
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(lo, lo));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(hi, hi));
+        }
+        sum += HorizontalSumAVX2(acc);
+    }
+
+    return sum + SumSquaredDifferencesGraySSE2(pRow1 + x, pRow2 + x, pixels - x);
+}
+
+__attribute__((target("avx2")))
+static void SumGrayAVX2(const uint8_t* pRow, size_t pixels, uint64_t& sum, uint64_t& sumSquares)
+{
+    const __m256i zero = _mm256_setzero_si256();
+
+    size_t x = 0;
+
+    while (x + 32 <= pixels) {
+        __m256i accSum    = zero;
+        __m256i accSquare = zero;
+        for (size_t n=0; n<BlockSize && x + 32 <= pixels; n++, x+=32) {
+            __m256i p  = _mm256_loadu_si256((const __m256i*)(pRow + x));
+            __m256i lo = _mm256_unpacklo_epi8(p, zero);
+            __m256i hi = _mm256_unpackhi_epi8(p, zero);
+
+            accSum    = _mm256_add_epi64(accSum, _mm256_sad_epu8(p, zero));
+            accSquare = _mm256_add_epi32(accSquare, _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi)));
+        }
+
+        alignas(32) uint64_t sums[4];
+        _mm256_store_si256((__m256i*)sums, accSum);
+        sum        += sums[0] + sums[1] + sums[2] + sums[3];
+        sumSquares += HorizontalSumAVX2(accSquare);
+    }
+
+    SumGraySSE2(pRow + x, pixels - x, sum, sumSquares);
+}
+
+#endif
+
+struct FrameKernels
+{
+    const char* pName;
+    uint64_t    (*pSumSquaredDifferences)(const uint8_t*, const uint8_t*, size_t);
+    void        (*pSumLuma)(const uint8_t*, size_t, uint64_t&, uint64_t&);
+    uint64_t    (*pSumSquaredDifferencesGray)(const uint8_t*, const uint8_t*, size_t);
+    void        (*pSumGray)(const uint8_t*, size_t, uint64_t&, uint64_t&);
+};
+
+// best first, every CPU can run the last one
+static const FrameKernels AllKernels[] = {
+#ifdef VIDTHUMB_X86
+    { "avx512", SumSquaredDifferencesAVX512, SumLumaAVX512, SumSquaredDifferencesGrayAVX2, SumGrayAVX2 },
+    { "avx2", SumSquaredDifferencesAVX2, SumLumaAVX2, SumSquaredDifferencesGrayAVX2, SumGrayAVX2 },
+    { "sse2", SumSquaredDifferencesSSE2, SumLumaSSE2, SumSquaredDifferencesGraySSE2, SumGraySSE2 },
+#endif
+    { "scalar", SumSquaredDifferencesScalar, SumLumaScalar, SumSquaredDifferencesGrayScalar, SumGrayScalar },
+};
+
+static bool IsSupported(const FrameKernels& kernels)
+{
+#ifdef VIDTHUMB_X86
+    __builtin_cpu_init();
+
+    if (!strcmp(kernels.pName, "avx512"))
+        return __builtin_cpu_supports("avx512bw");
+    if (!strcmp(kernels.pName, "avx2"))
+        return __builtin_cpu_supports("avx2");
+    if (!strcmp(kernels.pName, "sse2"))
+        return __builtin_cpu_supports("sse2");
+#endif
+
+    return true;
+}
+
+static const FrameKernels* SelectKernels()
+{
+    for (const FrameKernels& kernels : AllKernels) {
+        if (IsSupported(kernels))
+            return &kernels;
+    }
+    return nullptr;
+}
+
+// picked on first use, so kernels used during static initialization work too
+static const FrameKernels*& GetSelectedKernels()
+{
+    static const FrameKernels* pKernels = SelectKernels();
+    return pKernels;
+}
+
+static const FrameKernels& GetKernels()
+{
+    return *GetSelectedKernels();
+}
+
+std::vector<const char*> GetKernelNames()
+{
+    std::vector<const char*> names;
+    for (const FrameKernels& kernels : AllKernels) {
+        if (IsSupported(kernels))
+            names.push_back(kernels.pName);
+    }
+    return names;
+}
+
+bool SetKernels(const char* pName)
+{
+    for (const FrameKernels& kernels : AllKernels) {
+        if (!strcmp(kernels.pName, pName) && IsSupported(kernels)) {
+            GetSelectedKernels() = &kernels;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t SumSquaredDifferences(const uint8_t* pRow1, const uint8_t* pRow2, size_t pixels)
+{
+    return GetKernels().pSumSquaredDifferences(pRow1, pRow2, pixels);
+}
+
+void SumLuma(const uint8_t* pRow, size_t pixels, uint64_t& sum, uint64_t& sumSquares)
+{
+    GetKernels().pSumLuma(pRow, pixels, sum, sumSquares);
+}
+
+uint64_t SumSquaredDifferencesGray(const uint8_t* pRow1, const uint8_t* pRow2, size_t pixels)
+{
+    return GetKernels().pSumSquaredDifferencesGray(pRow1, pRow2, pixels);
+}
+
+void SumGray(const uint8_t* pRow, size_t pixels, uint64_t& sum, uint64_t& sumSquares)
+{
+    GetKernels().pSumGray(pRow, pixels, sum, sumSquares);
+}
+
+const char* GetKernelName()
+{
+    return GetKernels().pName;
+}
+
+}
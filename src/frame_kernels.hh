@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace vidthumb {
+
+// Pixel kernels used by Frame, working on rows of 32 bit pixels of which the
+// first three bytes are colour, or on rows of 8 bit gray pixels. The
+// vectorized versions are picked at run time from what the CPU supports and
+// match the scalar ones exactly.
+
+// sum of the squared differences of all colour bytes
+uint64_t SumSquaredDifferences(const uint8_t* pRow1, const uint8_t* pRow2, size_t pixels);
+uint64_t SumSquaredDifferencesScalar(const uint8_t* pRow1, const uint8_t* pRow2, size_t pixels);
+
+// sum and sum of squares of the 8 bit luma of all pixels
+void SumLuma(const uint8_t* pRow, size_t pixels, uint64_t& sum, uint64_t& sumSquares);
+void SumLumaScalar(const uint8_t* pRow, size_t pixels, uint64_t& sum, uint64_t& sumSquares);
+
+// the same for gray rows, one byte per pixel
+uint64_t SumSquaredDifferencesGray(const uint8_t* pRow1, const uint8_t* pRow2, size_t pixels);
+uint64_t SumSquaredDifferencesGrayScalar(const uint8_t* pRow1, const uint8_t* pRow2, size_t pixels);
+void SumGray(const uint8_t* pRow, size_t pixels, uint64_t& sum, uint64_t& sumSquares);
+void SumGrayScalar(const uint8_t* pRow, size_t pixels, uint64_t& sum, uint64_t& sumSquares);
+
+// name of the selected instruction set, for diagnostics
+const char* GetKernelName();
+
+// the instruction sets this CPU can run, best first, and switching to one
+// of them, for tests and benchmarks while no kernels are running
+std::vector<const char*> GetKernelNames();
+bool SetKernels(const char* pName);
+
+}
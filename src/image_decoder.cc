@@ -0,0 +1,341 @@
+#include "image_decoder.hh"
+#include "jpeg_error.hh"
+
+#include <cstdio>
+#include <cstring>
+#include <csetjmp>
+#include <algorithm>
+#include <mutex>
+
+extern "C" {
+#include <jpeglib.h>
+#include <png.h>
+#include <libswscale/swscale.h>
+}
+
+#include <IL/il.h>
+#include <IL/ilu.h>
+
+namespace vidthumb {
+
+void FitIntoBox(size_t width, size_t height, size_t boxWidth, size_t boxHeight, size_t& fitWidth, size_t& fitHeight)
+{
+    float scale = std::min( (float)boxWidth / width, (float)boxHeight / height );
+    fitWidth  = std::max<size_t>(width*scale, 1);
+    fitHeight = std::max<size_t>(height*scale, 1);
+}
+
+static uint16_t ReadUInt16(const uint8_t* p, bool bigEndian)
+{
+    return bigEndian ? (p[0] << 8 | p[1]) : (p[1] << 8 | p[0]);
+}
+
+static uint32_t ReadUInt32(const uint8_t* p, bool bigEndian)
+{
+    return bigEndian ? ((uint32_t)ReadUInt16(p, true) << 16 | ReadUInt16(p + 2, true)) :
+                       ((uint32_t)ReadUInt16(p + 2, false) << 16 | ReadUInt16(p, false));
+}
+
+// thumbnail of an EXIF segment, as given by IFD1
+static bool FindEXIFThumbnail(const uint8_t* pTIFF, size_t size, const uint8_t*& pThumbnail, size_t& thumbnailSize)
+{
+    if (size < 8 || (memcmp(pTIFF, "MM", 2) && memcmp(pTIFF, "II", 2)))
+        return false;
+
+    bool bigEndian = pTIFF[0] == 'M';
+
+    // skip IFD0, IFD1 follows it
+    uint32_t offset = ReadUInt32(pTIFF + 4, bigEndian);
+    if (offset > size - 2)
+        return false;
+
+    uint16_t entryCount = ReadUInt16(pTIFF + offset, bigEndian);
+    if (offset + 2 + entryCount*12 + 4 > size)
+        return false;
+
+    offset = ReadUInt32(pTIFF + offset + 2 + entryCount*12, bigEndian);
+    if (offset == 0 || offset > size - 2)
+        return false;
+
+    entryCount = ReadUInt16(pTIFF + offset, bigEndian);
+    if (offset + 2 + entryCount*12 > size)
+        return false;
+
+    uint32_t thumbnailOffset = 0, thumbnailLength = 0;
+    for (size_t i=0; i<entryCount; i++) {
+        const uint8_t* pEntry = pTIFF + offset + 2 + i*12;
+        uint16_t tag = ReadUInt16(pEntry, bigEndian);
+
+        // JPEGInterchangeFormat and JPEGInterchangeFormatLength, both LONG
+        if (tag == 0x0201)
+            thumbnailOffset = ReadUInt32(pEntry + 8, bigEndian);
+        else if (tag == 0x0202)
+            thumbnailLength = ReadUInt32(pEntry + 8, bigEndian);
+    }
+
+    if (!thumbnailOffset || !thumbnailLength || thumbnailOffset > size || thumbnailLength > size - thumbnailOffset)
+        return false;
+
+    pThumbnail    = pTIFF + thumbnailOffset;
+    thumbnailSize = thumbnailLength;
+    return true;
+}
+
+bool FindJPEGThumbnail(const uint8_t* pData, size_t size, const uint8_t*& pThumbnail, size_t& thumbnailSize)
+{
+    // the metadata segments come right after the start of image marker, the
+    // first one that is not an application segment ends the search
+    size_t offset = 2;
+    while (offset + 4 <= size && pData[offset] == 0xff) {
+        uint8_t        marker  = pData[offset + 1];
+        size_t         length  = ReadUInt16(pData + offset + 2, true);
+        const uint8_t* pSegment = pData + offset + 4;
+
+        if (marker < 0xe0 || marker > 0xef || length < 2 || offset + 2 + length > size)
+            break;
+
+        size_t segmentSize = length - 2;
+        if (marker == 0xe1 && segmentSize > 6 && !memcmp(pSegment, "Exif\0\0", 6)) {
+            if (FindEXIFThumbnail(pSegment + 6, segmentSize - 6, pThumbnail, thumbnailSize))
+                return true;
+        } else if (marker == 0xe0 && segmentSize > 6 && !memcmp(pSegment, "JFXX\0", 5) && pSegment[5] == 0x10) {
+            // JFIF extension with a JPEG coded thumbnail
+            pThumbnail    = pSegment + 6;
+            thumbnailSize = segmentSize - 6;
+            return true;
+        }
+
+        offset += 2 + length;
+    }
+
+    return false;
+}
+
+static void JPEGOutputMessage(j_common_ptr pInfo)
+{
+    // warnings about slightly broken files are not worth a line each
+    (void)pInfo;
+}
+
+ImageDecoder::ImageDecoder() :
+    pSwsContext                 { nullptr },
+    ImageWidth                  { 0 },
+    ImageHeight                 { 0 },
+    PixelsWidth                 { 0 },
+    PixelsHeight                { 0 },
+    PixelsStride                { 0 },
+    PixelsFormat                { AV_PIX_FMT_NONE }
+{
+    // decoders are created from several threads at once
+    static std::once_flag initFlag;
+    std::call_once(initFlag, []() {
+        ilInit();
+        iluInit();
+    });
+}
+
+ImageDecoder::~ImageDecoder()
+{
+    if (this->pSwsContext)
+        sws_freeContext(this->pSwsContext);
+}
+
+bool ImageDecoder::Decode(const uint8_t* pData, size_t size, size_t boxWidth, size_t boxHeight, 
+                          PixelFormat format, bool highQuality, Frame& frame)
+{
+    bool decoded = false;
+
+    if (size >= 3 && pData[0] == 0xff && pData[1] == 0xd8 && pData[2] == 0xff) {
+        if (!highQuality && format == PixelFormat::Gray && this->DecodeThumbnail(pData, size, boxWidth, boxHeight, frame))
+            return true;
+
+        decoded = this->DecodeJPEG(pData, size, boxWidth, boxHeight, format);
+    }
+    else if (size >= 8 && !png_sig_cmp((png_const_bytep)pData, 0, 8))
+        decoded = this->DecodePNG(pData, size, format);
+
+    if (decoded)
+        return this->Scale(boxWidth, boxHeight, format, highQuality, frame);
+
+    // other formats and files the libraries refused, CMYK JPEGs for example
+    return this->DecodeDevIL(pData, size, boxWidth, boxHeight, format, highQuality, frame);
+}
+
+bool ImageDecoder::DecodeJPEG(const uint8_t* pData, size_t size, size_t boxWidth, size_t boxHeight, PixelFormat format)
+{
+    jpeg_decompress_struct  info;
+    JPEGErrorManager        error;
+
+    info.err = jpeg_std_error(&error.base);
+    error.base.error_exit     = JPEGErrorExit;
+    error.base.output_message = JPEGOutputMessage;
+
+    if (setjmp(error.jump)) {
+        jpeg_destroy_decompress(&info);
+        return false;
+    }
+
+    jpeg_create_decompress(&info);
+    jpeg_mem_src(&info, (unsigned char*)pData, size);
+    jpeg_read_header(&info, TRUE);
+
+    // gray output is just the luma channel, no colour conversion at all
+    bool gray = format == PixelFormat::Gray;
+    info.out_color_space = gray ? JCS_GRAYSCALE : JCS_RGB;
+
+    // let the IDCT scale down by up to 1/8, but never below the fitted size
+    this->ImageWidth  = info.image_width;
+    this->ImageHeight = info.image_height;
+
+    size_t width, height;
+    FitIntoBox(info.image_width, info.image_height, boxWidth, boxHeight, width, height);
+
+    info.scale_num = 1;
+    for (unsigned denom = 8; denom > 1; denom /= 2) {
+        info.scale_denom = denom;
+        jpeg_calc_output_dimensions(&info);
+        if (info.output_width >= width && info.output_height >= height)
+            break;
+    }
+    if (info.output_width < width || info.output_height < height)
+        info.scale_denom = 1;
+
+    jpeg_start_decompress(&info);
+
+    this->PixelsWidth  = info.output_width;
+    this->PixelsHeight = info.output_height;
+    this->PixelsStride = info.output_width * info.output_components;
+    this->PixelsFormat = gray ? AV_PIX_FMT_GRAY8 : AV_PIX_FMT_RGB24;
+    this->Pixels.resize(this->PixelsStride * this->PixelsHeight);
+
+    while (info.output_scanline < info.output_height) {
+        JSAMPROW row = this->Pixels.data() + info.output_scanline * this->PixelsStride;
+        jpeg_read_scanlines(&info, &row, 1);
+    }
+
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+    return true;
+}
+
+bool ImageDecoder::DecodeThumbnail(const uint8_t* pData, size_t size, size_t boxWidth, size_t boxHeight, Frame& frame)
+{
+    const uint8_t* pThumbnail;
+    size_t         thumbnailSize;
+
+    if (!FindJPEGThumbnail(pData, size, pThumbnail, thumbnailSize) || thumbnailSize < 3 || pThumbnail[0] != 0xff || pThumbnail[1] != 0xd8)
+        return false;
+
+    if (!this->DecodeJPEG(pThumbnail, thumbnailSize, boxWidth, boxHeight, PixelFormat::Gray))
+        return false;
+
+    // a thumbnail smaller than the box would have to be scaled up
+    size_t width, height;
+    FitIntoBox(this->ImageWidth, this->ImageHeight, boxWidth, boxHeight, width, height);
+    if (width > this->ImageWidth || height > this->ImageHeight)
+        return false;
+
+    return this->Scale(boxWidth, boxHeight, PixelFormat::Gray, false, frame);
+}
+
+bool ImageDecoder::DecodePNG(const uint8_t* pData, size_t size, PixelFormat format)
+{
+    // the simplified API does the error handling and conversions on its own
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+
+    if (!png_image_begin_read_from_memory(&image, pData, size))
+        return false;
+
+    bool gray = format == PixelFormat::Gray;
+    image.format = gray ? PNG_FORMAT_GRAY : PNG_FORMAT_BGRA;
+
+    this->ImageWidth   = image.width;
+    this->ImageHeight  = image.height;
+    this->PixelsWidth  = image.width;
+    this->PixelsHeight = image.height;
+    this->PixelsStride = PNG_IMAGE_ROW_STRIDE(image);
+    this->PixelsFormat = gray ? AV_PIX_FMT_GRAY8 : AV_PIX_FMT_BGRA;
+    this->Pixels.resize(PNG_IMAGE_BUFFER_SIZE(image, this->PixelsStride));
+
+    if (!png_image_finish_read(&image, nullptr, this->Pixels.data(), this->PixelsStride, nullptr)) {
+        png_image_free(&image);
+        return false;
+    }
+    return true;
+}
+
+bool ImageDecoder::DecodeDevIL(const uint8_t* pData, size_t size, size_t boxWidth, size_t boxHeight,
+                               PixelFormat format, bool highQuality, Frame& frame)
+{
+    // DevIL keeps the bound image in global state
+    static std::mutex devilMutex;
+    std::lock_guard<std::mutex> lock(devilMutex);
+
+    bool success = true;
+    ILuint image = ilGenImage();
+    ilBindImage(image);
+
+    if (!ilLoadL(IL_TYPE_UNKNOWN, pData, size)) {
+        success = false;
+    } else {
+        size_t width, height;
+        FitIntoBox(ilGetInteger(IL_IMAGE_WIDTH), ilGetInteger(IL_IMAGE_HEIGHT), boxWidth, boxHeight, width, height);
+
+        ILenum ilFormat      = format == PixelFormat::RGB ? IL_BGRA : IL_LUMINANCE;
+        size_t bytesPerPixel = format == PixelFormat::RGB ? 4 : 1;
+
+        ilConvertImage(ilFormat, IL_UNSIGNED_BYTE);
+
+        iluImageParameter(ILU_FILTER, highQuality ? ILU_BILINEAR : ILU_NEAREST);
+        iluScale(width, height, 1);
+
+        // rows are copied from DevIL's own buffer into the frame's, which is
+        // reused if the size matches
+        const uint8_t* pPixels  = ilGetData();
+        size_t         rowSize  = width*bytesPerPixel;
+        bool           bottomUp = ilGetInteger(IL_IMAGE_ORIGIN) == IL_ORIGIN_LOWER_LEFT;
+
+        if (!pPixels || (size_t)ilGetInteger(IL_IMAGE_WIDTH) != width || (size_t)ilGetInteger(IL_IMAGE_HEIGHT) != height) {
+            success = false;
+        } else {
+            frame.Allocate(width, height, format);
+            for (size_t y=0; y<height; y++) {
+                size_t row = bottomUp ? height - 1 - y : y;
+                ::memcpy(frame.GetData() + y*frame.GetStride(), pPixels + row*rowSize, rowSize);
+            }
+        }
+    }
+
+    ilDeleteImage(image);
+    return success;
+}
+
+bool ImageDecoder::Scale(size_t boxWidth, size_t boxHeight, PixelFormat format, bool highQuality, Frame& frame)
+{
+    size_t width, height;
+    FitIntoBox(this->ImageWidth, this->ImageHeight, boxWidth, boxHeight, width, height);
+
+    // same filters as for video frames
+    this->pSwsContext = sws_getCachedContext(
+        this->pSwsContext,
+        this->PixelsWidth, this->PixelsHeight, (AVPixelFormat)this->PixelsFormat,
+        width, height, format == PixelFormat::RGB ? AV_PIX_FMT_RGB32 : AV_PIX_FMT_GRAY8,
+        highQuality ? SWS_LANCZOS : SWS_AREA, nullptr, nullptr, nullptr
+    );
+    if (!this->pSwsContext)
+        return false;
+
+    frame.Allocate(width, height, format);
+
+    const uint8_t*  sourceData[4]       = { this->Pixels.data(), nullptr, nullptr, nullptr };
+    int             sourceLineSize[4]   = { (int)this->PixelsStride, 0, 0, 0 };
+    uint8_t*        targetData[4]       = { frame.GetData(), nullptr, nullptr, nullptr };
+    int             targetLineSize[4]   = { (int)frame.GetStride(), 0, 0, 0 };
+
+    sws_scale(this->pSwsContext, sourceData, sourceLineSize, 0, this->PixelsHeight, targetData, targetLineSize);
+    return true;
+}
+
+}
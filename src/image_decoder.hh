@@ -0,0 +1,62 @@
+#pragma once
+
+#include "frame.hh"
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+struct SwsContext;
+
+namespace vidthumb 
+{
+
+// Decodes encoded images into frames fitted into a box, keeping their aspect.
+// JPEG and PNG go through libjpeg and libpng, so separate decoders can run on 
+// separate threads. Anything else goes through DevIL, one image at a time.
+// Low quality frames of JPEGs come from the embedded EXIF or JFIF thumbnail 
+// when there is one large enough.
+class ImageDecoder
+{
+public:
+
+                        ImageDecoder();
+                        ~ImageDecoder();
+
+                        ImageDecoder(const ImageDecoder&) = delete;
+    ImageDecoder&       operator=(const ImageDecoder&) = delete;
+
+    bool                Decode(const uint8_t* pData, size_t size, size_t boxWidth, size_t boxHeight, 
+                               PixelFormat format, bool highQuality, Frame& frame);
+
+private:
+
+    SwsContext*         pSwsContext;
+
+    // size of the encoded image, which is what the frame is fitted by
+    size_t              ImageWidth;
+    size_t              ImageHeight;
+
+    // decoded image before scaling, JPEGs may already be scaled down
+    std::vector<uint8_t> Pixels;
+    size_t              PixelsWidth;
+    size_t              PixelsHeight;
+    size_t              PixelsStride;
+    int                 PixelsFormat;
+
+    bool                DecodeJPEG(const uint8_t* pData, size_t size, size_t boxWidth, size_t boxHeight, PixelFormat format);
+    bool                DecodeThumbnail(const uint8_t* pData, size_t size, size_t boxWidth, size_t boxHeight, Frame& frame);
+    bool                DecodePNG(const uint8_t* pData, size_t size, PixelFormat format);
+    bool                DecodeDevIL(const uint8_t* pData, size_t size, size_t boxWidth, size_t boxHeight,
+                                    PixelFormat format, bool highQuality, Frame& frame);
+
+    bool                Scale(size_t boxWidth, size_t boxHeight, PixelFormat format, bool highQuality, Frame& frame);
+};
+
+// find the JPEG thumbnail in the EXIF or JFIF extension segment of a JPEG
+bool FindJPEGThumbnail(const uint8_t* pData, size_t size, const uint8_t*& pThumbnail, size_t& thumbnailSize);
+
+// size of an image fitted into a box, keeping its aspect
+void FitIntoBox(size_t width, size_t height, size_t boxWidth, size_t boxHeight, size_t& fitWidth, size_t& fitHeight);
+
+}
@@ -0,0 +1,534 @@
+#include "image_writer.hh"
+#include "jpeg_error.hh"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csetjmp>
+#include <algorithm>
+#include <deque>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+extern "C" {
+#include <jpeglib.h>
+}
+
+#ifdef HAVE_WEBP
+#include <webp/encode.h>
+#endif
+
+namespace vidthumb {
+
+void ConvertRowToRGB(const uint8_t* pSource, uint8_t* pTarget, size_t width)
+{
+    // the pixels are native endian words, the unused byte on top
+    for (size_t x=0; x<width; x++) {
+        uint32_t pixel;
+        ::memcpy(&pixel, pSource + x*4, 4);
+        pTarget[x*3 + 0] = pixel >> 16;
+        pTarget[x*3 + 1] = pixel >> 8;
+        pTarget[x*3 + 2] = pixel;
+    }
+}
+
+ImageWriter::ImageWriter(const char *pFileName, const ImageWriterOptions& options) :
+    FileName                    { pFileName },
+    Options                     { options },
+    pFile                       { nullptr },
+    pTarget                     { nullptr }
+{
+}
+
+ImageWriter::~ImageWriter()
+{
+    if (this->pFile)
+        this->CloseFile();
+}
+
+bool ImageWriter::OpenFile()
+{
+    this->pFile = this->pTarget ? this->pTarget : fopen(this->FileName.c_str(), "wb");
+    return this->pFile != nullptr;
+}
+
+bool ImageWriter::CloseFile()
+{
+    // the caller's file is only flushed, it closes it itself
+    bool success = !ferror(this->pFile);
+    if (this->pFile == this->pTarget)
+        success = fflush(this->pFile) == 0 && success;
+    else
+        success = fclose(this->pFile) == 0 && success;
+    this->pFile = nullptr;
+    return success;
+}
+
+namespace {
+
+// Rows are filtered and deflated in blocks on separate threads, each block
+// ending on a byte boundary with a sync flush so the blocks can simply be
+// concatenated into one zlib stream. The adler32 checksums of the blocks are
+// combined in order.
+class PNGWriter : public ImageWriter
+{
+public:
+
+                        PNGWriter(const char *pFileName, const ImageWriterOptions& options);
+                        ~PNGWriter();
+
+    bool                Begin(size_t width, size_t height) override;
+    bool                WriteRows(const uint8_t* pRows, size_t rowCount, size_t stride) override;
+    bool                End() override;
+
+private:
+
+    struct CompressedBlock
+    {
+        std::vector<uint8_t> data;
+        uint32_t        adler;
+        size_t          length;
+        bool            success;
+    };
+
+    size_t              Width;
+    size_t              Height;
+    size_t              RowsPerBlock;
+    size_t              ThreadCount;
+    bool                Failed;
+
+    // raw rows of the block being filled, and the last row of the one before
+    std::vector<uint8_t> BlockRows;
+    size_t              BlockRowCount;
+    std::vector<uint8_t> PreviousRow;
+
+    std::deque<std::future<CompressedBlock>> PendingBlocks;
+    uint32_t            Adler;
+
+    static CompressedBlock CompressBlock(std::vector<uint8_t> rows, std::vector<uint8_t> previousRow, size_t width, int level, bool last);
+
+    void                SubmitBlock(bool last);
+    void                WriteBlock();
+    void                WriteChunk(const char* pType, const uint8_t* pData, size_t size);
+};
+
+PNGWriter::PNGWriter(const char *pFileName, const ImageWriterOptions& options) :
+    ImageWriter                 { pFileName, options },
+    Width                       { 0 },
+    Height                      { 0 },
+    RowsPerBlock                { 0 },
+    ThreadCount                 { 0 },
+    Failed                      { false },
+    BlockRowCount               { 0 },
+    Adler                       { 0 }
+{
+}
+
+PNGWriter::~PNGWriter()
+{
+    // blocks still being compressed if End was never reached
+    for (auto& block : this->PendingBlocks)
+        block.wait();
+}
+
+bool PNGWriter::Begin(size_t width, size_t height)
+{
+    if (!this->OpenFile())
+        return false;
+
+    this->Width         = width;
+    this->Height        = height;
+    this->Failed        = false;
+    this->Adler         = adler32(0, Z_NULL, 0);
+    this->ThreadCount   = this->Options.threadCount ? this->Options.threadCount : std::max<unsigned>(std::thread::hardware_concurrency(), 1);
+
+    // blocks of about 256 KiB filtered, small enough to spread over the threads
+    this->RowsPerBlock  = std::max<size_t>(1, (256 << 10) / (width*3 + 1));
+    this->BlockRows.resize(this->RowsPerBlock * width * 4);
+    this->BlockRowCount = 0;
+    this->PreviousRow.clear();
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    fwrite(signature, 1, sizeof(signature), this->pFile);
+
+    uint8_t header[13] = {
+        (uint8_t)(width >> 24),  (uint8_t)(width >> 16),  (uint8_t)(width >> 8),  (uint8_t)width,
+        (uint8_t)(height >> 24), (uint8_t)(height >> 16), (uint8_t)(height >> 8), (uint8_t)height,
+        8, 2, 0, 0, 0   // 8 bit RGB, deflate, adaptive filters, no interlace
+    };
+    this->WriteChunk("IHDR", header, sizeof(header));
+
+    // zlib header in a chunk of its own, the blocks are raw deflate data
+    int     level      = std::min(std::max(this->Options.compressionLevel, 0), 9);
+    uint8_t levelFlags = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+    uint8_t zlibHeader[2] = { 0x78, (uint8_t)(levelFlags << 6) };
+    zlibHeader[1] += 31 - (zlibHeader[0] * 256 + zlibHeader[1]) % 31;
+    this->WriteChunk("IDAT", zlibHeader, sizeof(zlibHeader));
+
+    return !ferror(this->pFile);
+}
+
+bool PNGWriter::WriteRows(const uint8_t* pRows, size_t rowCount, size_t stride)
+{
+    if (!this->pFile)
+        return false;
+
+    for (size_t y=0; y<rowCount; y++) {
+        ::memcpy(this->BlockRows.data() + this->BlockRowCount * this->Width * 4, pRows + y*stride, this->Width * 4);
+
+        if (++this->BlockRowCount == this->RowsPerBlock)
+            this->SubmitBlock(false);
+    }
+
+    return !this->Failed;
+}
+
+bool PNGWriter::End()
+{
+    if (!this->pFile)
+        return false;
+
+    // the last block finishes the deflate stream, even if it has no rows
+    this->SubmitBlock(true);
+    while (!this->PendingBlocks.empty())
+        this->WriteBlock();
+
+    uint8_t adler[4] = { (uint8_t)(this->Adler >> 24), (uint8_t)(this->Adler >> 16), (uint8_t)(this->Adler >> 8), (uint8_t)this->Adler };
+    this->WriteChunk("IDAT", adler, sizeof(adler));
+    this->WriteChunk("IEND", nullptr, 0);
+
+    bool success = !this->Failed;
+    return this->CloseFile() && success;
+}
+
+void PNGWriter::SubmitBlock(bool last)
+{
+    // keep at most one block per thread in flight, written in order
+    if (this->PendingBlocks.size() >= this->ThreadCount)
+        this->WriteBlock();
+
+    std::vector<uint8_t> rows(this->BlockRows.begin(), this->BlockRows.begin() + this->BlockRowCount * this->Width * 4);
+    std::vector<uint8_t> previousRow = this->PreviousRow;
+
+    if (this->BlockRowCount)
+        this->PreviousRow.assign(rows.end() - this->Width * 4, rows.end());
+    this->BlockRowCount = 0;
+
+    this->PendingBlocks.push_back(std::async(std::launch::async, &PNGWriter::CompressBlock,
+        std::move(rows), std::move(previousRow), this->Width, std::min(std::max(this->Options.compressionLevel, 0), 9), last));
+}
+
+void PNGWriter::WriteBlock()
+{
+    CompressedBlock block = this->PendingBlocks.front().get();
+    this->PendingBlocks.pop_front();
+
+    if (!block.success) {
+        this->Failed = true;
+        return;
+    }
+
+    this->Adler = adler32_combine(this->Adler, block.adler, block.length);
+    this->WriteChunk("IDAT", block.data.data(), block.data.size());
+}
+
+void PNGWriter::WriteChunk(const char* pType, const uint8_t* pData, size_t size)
+{
+    uint8_t length[4] = { (uint8_t)(size >> 24), (uint8_t)(size >> 16), (uint8_t)(size >> 8), (uint8_t)size };
+
+    uint32_t crc = crc32(0, (const Bytef*)pType, 4);
+    if (size)
+        crc = crc32(crc, pData, size);
+    uint8_t checksum[4] = { (uint8_t)(crc >> 24), (uint8_t)(crc >> 16), (uint8_t)(crc >> 8), (uint8_t)crc };
+
+    fwrite(length, 1, 4, this->pFile);
+    fwrite(pType, 1, 4, this->pFile);
+    if (size)
+        fwrite(pData, 1, size, this->pFile);
+    fwrite(checksum, 1, 4, this->pFile);
+}
+
+PNGWriter::CompressedBlock PNGWriter::CompressBlock(std::vector<uint8_t> rows, std::vector<uint8_t> previousRow, size_t width, int level, bool last)
+{
+    CompressedBlock block;
+    size_t rowCount = rows.size() / (width * 4);
+    size_t rowSize  = width * 3;
+
+    // Paeth filter on every row, against the last row of the previous block
+    std::vector<uint8_t> filtered(rowCount * (rowSize + 1));
+    std::vector<uint8_t> current(rowSize), prior(rowSize, 0);
+    if (!previousRow.empty())
+        ConvertRowToRGB(previousRow.data(), prior.data(), width);
+
+    for (size_t y=0; y<rowCount; y++) {
+        ConvertRowToRGB(rows.data() + y * width * 4, current.data(), width);
+
+        uint8_t* pOut = filtered.data() + y * (rowSize + 1);
+        *pOut++ = 4;
+        for (size_t x=0; x<rowSize; x++) {
+            int a = x >= 3 ? current[x - 3] : 0;
+            int b = prior[x];
+            int c = x >= 3 ? prior[x - 3] : 0;
+            int p = a + b - c;
+            int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+            int predictor = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+            pOut[x] = current[x] - predictor;
+        }
+        std::swap(current, prior);
+    }
+
+    block.length = filtered.size();
+    block.adler  = adler32(adler32(0, Z_NULL, 0), filtered.data(), filtered.size());
+
+    z_stream stream;
+    ::memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        block.success = false;
+        return block;
+    }
+
+    // room for the worst case plus the empty stored block of the sync flush
+    block.data.resize(deflateBound(&stream, filtered.size()) + 16);
+    stream.next_in   = filtered.data();
+    stream.avail_in  = filtered.size();
+    stream.next_out  = block.data.data();
+    stream.avail_out = block.data.size();
+
+    int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    block.success = (last ? result == Z_STREAM_END : result == Z_OK) && stream.avail_in == 0;
+    block.data.resize(stream.total_out);
+
+    deflateEnd(&stream);
+    return block;
+}
+
+class JPEGWriter : public ImageWriter
+{
+public:
+
+                        JPEGWriter(const char *pFileName, const ImageWriterOptions& options);
+                        ~JPEGWriter();
+
+    bool                Begin(size_t width, size_t height) override;
+    bool                WriteRows(const uint8_t* pRows, size_t rowCount, size_t stride) override;
+    bool                End() override;
+
+private:
+
+    jpeg_compress_struct Info;
+    JPEGErrorManager    Error;
+    bool                Started;
+    std::vector<uint8_t> Row;
+
+    void                Abort();
+};
+
+// libjpeg-turbo takes the pixels as they are on little endian machines
+#if defined(JCS_EXTENSIONS) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define JPEG_WRITER_BGRX
+#endif
+
+JPEGWriter::JPEGWriter(const char *pFileName, const ImageWriterOptions& options) :
+    ImageWriter                 { pFileName, options },
+    Started                     { false }
+{
+}
+
+JPEGWriter::~JPEGWriter()
+{
+    this->Abort();
+}
+
+void JPEGWriter::Abort()
+{
+    if (this->Started)
+        jpeg_destroy_compress(&this->Info);
+    this->Started = false;
+
+    if (this->pFile)
+        this->CloseFile();
+}
+
+bool JPEGWriter::Begin(size_t width, size_t height)
+{
+    if (!this->OpenFile())
+        return false;
+
+    this->Info.err = jpeg_std_error(&this->Error.base);
+    this->Error.base.error_exit = JPEGErrorExit;
+
+    if (setjmp(this->Error.jump)) {
+        this->Abort();
+        return false;
+    }
+
+    jpeg_create_compress(&this->Info);
+    this->Started = true;
+    jpeg_stdio_dest(&this->Info, this->pFile);
+
+    this->Info.image_width      = width;
+    this->Info.image_height     = height;
+#ifdef JPEG_WRITER_BGRX
+    this->Info.input_components = 4;
+    this->Info.in_color_space   = JCS_EXT_BGRX;
+#else
+    this->Info.input_components = 3;
+    this->Info.in_color_space   = JCS_RGB;
+    this->Row.resize(width * 3);
+#endif
+
+    jpeg_set_defaults(&this->Info);
+    jpeg_set_quality(&this->Info, std::min(std::max(this->Options.quality, 1), 100), TRUE);
+    jpeg_start_compress(&this->Info, TRUE);
+    return true;
+}
+
+bool JPEGWriter::WriteRows(const uint8_t* pRows, size_t rowCount, size_t stride)
+{
+    if (!this->Started)
+        return false;
+
+    if (setjmp(this->Error.jump)) {
+        this->Abort();
+        return false;
+    }
+
+    for (size_t y=0; y<rowCount; y++) {
+#ifdef JPEG_WRITER_BGRX
+        JSAMPROW row = (JSAMPROW)(pRows + y*stride);
+#else
+        ConvertRowToRGB(pRows + y*stride, this->Row.data(), this->Info.image_width);
+        JSAMPROW row = this->Row.data();
+#endif
+        jpeg_write_scanlines(&this->Info, &row, 1);
+    }
+    return true;
+}
+
+bool JPEGWriter::End()
+{
+    if (!this->Started)
+        return false;
+
+    if (setjmp(this->Error.jump)) {
+        this->Abort();
+        return false;
+    }
+
+    jpeg_finish_compress(&this->Info);
+    jpeg_destroy_compress(&this->Info);
+    this->Started = false;
+
+    return this->CloseFile();
+}
+
+#ifdef HAVE_WEBP
+// libwebp only encodes whole images, so the rows are collected first
+class WebPWriter : public ImageWriter
+{
+public:
+
+                        WebPWriter(const char *pFileName, const ImageWriterOptions& options);
+
+    bool                Begin(size_t width, size_t height) override;
+    bool                WriteRows(const uint8_t* pRows, size_t rowCount, size_t stride) override;
+    bool                End() override;
+
+private:
+
+    size_t              Width;
+    size_t              Height;
+    size_t              RowsWritten;
+    std::vector<uint8_t> Pixels;
+};
+
+WebPWriter::WebPWriter(const char *pFileName, const ImageWriterOptions& options) :
+    ImageWriter                 { pFileName, options },
+    Width                       { 0 },
+    Height                      { 0 },
+    RowsWritten                 { 0 }
+{
+}
+
+bool WebPWriter::Begin(size_t width, size_t height)
+{
+    if (width > WEBP_MAX_DIMENSION || height > WEBP_MAX_DIMENSION)
+        return false;
+
+    this->Width       = width;
+    this->Height      = height;
+    this->RowsWritten = 0;
+    this->Pixels.resize(width * height * 3);
+    return true;
+}
+
+bool WebPWriter::WriteRows(const uint8_t* pRows, size_t rowCount, size_t stride)
+{
+    rowCount = std::min(rowCount, this->Height - this->RowsWritten);
+    for (size_t y=0; y<rowCount; y++, this->RowsWritten++)
+        ConvertRowToRGB(pRows + y*stride, this->Pixels.data() + this->RowsWritten * this->Width * 3, this->Width);
+    return true;
+}
+
+bool WebPWriter::End()
+{
+    uint8_t* pOutput = nullptr;
+    size_t   size    = WebPEncodeRGB(this->Pixels.data(), this->Width, this->Height, this->Width * 3, std::min(std::max(this->Options.quality, 1), 100), &pOutput);
+    if (!size)
+        return false;
+
+    bool success = this->OpenFile() && fwrite(pOutput, 1, size, this->pFile) == size;
+    if (this->pFile)
+        success = this->CloseFile() && success;
+
+    WebPFree(pOutput);
+    return success;
+}
+#endif
+
+}
+
+ImageWriter* ImageWriter::Create(const char *pFileName, const ImageWriterOptions& options)
+{
+    std::string format = options.format;
+    if (format.empty()) {
+        const char* pExtension = strrchr(pFileName, '.');
+        format = pExtension && !strchr(pExtension, '/') ? pExtension + 1 : "";
+    }
+    std::transform(format.begin(), format.end(), format.begin(), ::tolower);
+
+    if (format == "jpg" || format == "jpeg")
+        return new JPEGWriter(pFileName, options);
+
+    if (format == "webp") {
+#ifdef HAVE_WEBP
+        return new WebPWriter(pFileName, options);
+#else
+        return nullptr;
+#endif
+    }
+
+    // anything else is written as PNG, unless it was asked for by name
+    if (format == "png" || options.format.empty())
+        return new PNGWriter(pFileName, options);
+
+    return nullptr;
+}
+
+ImageWriter* ImageWriter::Create(FILE* pFile, const ImageWriterOptions& options)
+{
+    ImageWriterOptions fileOptions = options;
+    if (fileOptions.format.empty())
+        fileOptions.format = "png";
+
+    ImageWriter* pWriter = Create("", fileOptions);
+    if (pWriter)
+        pWriter->pTarget = pFile;
+    return pWriter;
+}
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+namespace vidthumb 
+{
+
+struct ImageWriterOptions
+{
+    // png, jpeg or webp, taken from the file name's extension if empty
+    std::string         format;
+
+    // JPEG and WebP quality, 1 to 100
+    int                 quality             = 90;
+
+    // PNG deflate level, 0 to 9
+    int                 compressionLevel    = 6;
+
+    // PNG compression threads, 0 for one per core
+    size_t              threadCount         = 0;
+};
+
+// Writes an image of 32 bit pixels as cairo's RGB24 format has them, rows 
+// passed in top to bottom in as many calls as suits the caller.
+class ImageWriter
+{
+public:
+
+    // a writer for the format the options or the file name ask for, nullptr
+    // if that format is not supported
+    static ImageWriter* Create(const char *pFileName, const ImageWriterOptions& options);
+
+    // a writer into a file the caller opened and closes, in the format the
+    // options ask for, PNG if none
+    static ImageWriter* Create(FILE* pFile, const ImageWriterOptions& options);
+
+    virtual             ~ImageWriter();
+
+                        ImageWriter(const ImageWriter&) = delete;
+    ImageWriter&        operator=(const ImageWriter&) = delete;
+
+    virtual bool        Begin(size_t width, size_t height) = 0;
+    virtual bool        WriteRows(const uint8_t* pRows, size_t rowCount, size_t stride) = 0;
+    virtual bool        End() = 0;
+
+protected:
+
+                        ImageWriter(const char *pFileName, const ImageWriterOptions& options);
+
+    std::string         FileName;
+    ImageWriterOptions  Options;
+
+    // the file being written, and the caller's file if there is one
+    FILE*               pFile;
+    FILE*               pTarget;
+
+    bool                OpenFile();
+    bool                CloseFile();
+};
+
+// convert a row of 32 bit RGB24 pixels to packed 8 bit RGB
+void ConvertRowToRGB(const uint8_t* pSource, uint8_t* pTarget, size_t width);
+
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <csetjmp>
+#include <cstdio>
+
+extern "C" {
+#include <jpeglib.h>
+}
+
+namespace vidthumb
+{
+
+// Error handling of the JPEG decoder and writer. libjpeg calls exit() on
+// errors unless told otherwise, JPEGErrorExit jumps back to the setjmp on
+// jump instead.
+struct JPEGErrorManager
+{
+    jpeg_error_mgr      base;
+    jmp_buf             jump;
+};
+
+inline void JPEGErrorExit(j_common_ptr pInfo)
+{
+    longjmp(((JPEGErrorManager*)pInfo->err)->jump, 1);
+}
+
+}
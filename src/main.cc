@@ -1,16 +1,24 @@
-#include "frame.hh"
-#include "stream.hh"
+#include "batch.hh"
+#include "overview.hh"
+#include "server.hh"
 
+#include <csignal>
 #include <cstdio>
-extern "C" {
-#include <libavformat/avformat.h>
-}
+#include <cstdlib>
+#include <cstring>
 
-#include <vector>
-#include <algorithm>
 #include <iostream>
+#include <string>
+
+#include <sys/stat.h>
+
+static vidthumb::Server* pServer = nullptr;
 
-#include <cairo/cairo.h>
+static void StopServer(int)
+{
+    if (pServer)
+        pServer->Stop();
+}
 
 int main(int argc, char **argv)
 {
@@ -18,190 +26,148 @@ int main(int argc, char **argv)
         return -1;
     }
 
-    bool portrait = false;
-    if (!::strcmp(argv[1], "-p")) {
-        portrait = true;
+    vidthumb::OverviewOptions options;
+    bool batch = false;
+    size_t workerCount = 0;
+    const char *pStateFileName = nullptr;
+    const char *pSocketName = nullptr;
+    size_t queueLength = 64;
+    while (argc > 1 && argv[1][0] == '-') {
+        if (!::strcmp(argv[1], "-p")) {
+            options.portrait = true;
+        } else if (!::strcmp(argv[1], "-s")) {
+            options.singlePass = true;
+        } else if (!::strcmp(argv[1], "-k")) {
+            options.keyFramesOnly = true;
+        } else if (!::strcmp(argv[1], "-t") && argc > 2) {
+            options.threadCount = ::strtoul(argv[2], nullptr, 10);
+            argc--;
+            argv++;
+        } else if (!::strcmp(argv[1], "-a") && argc > 2) {
+            if (::sscanf(argv[2], "%zux%zu", &options.analysisWidth, &options.analysisHeight) != 2 || !options.analysisWidth || !options.analysisHeight) {
+                std::cerr << "Invalid analysis size " << argv[2] << std::endl;
+                return -1;
+            }
+            argc--;
+            argv++;
+        } else if (!::strcmp(argv[1], "-G") && argc > 2) {
+            if (::sscanf(argv[2], "%zux%zu", &options.columns, &options.rows) != 2 || !options.columns || !options.rows) {
+                std::cerr << "Invalid grid size " << argv[2] << std::endl;
+                return -1;
+            }
+            argc--;
+            argv++;
+        } else if (!::strcmp(argv[1], "-d") && argc > 2) {
+            if (::sscanf(argv[2], "%zux%zu", &options.thumbWidth, &options.thumbHeight) != 2 || !options.thumbWidth || !options.thumbHeight) {
+                std::cerr << "Invalid thumbnail size " << argv[2] << std::endl;
+                return -1;
+            }
+            argc--;
+            argv++;
+        } else if (!::strcmp(argv[1], "-g") && argc > 2) {
+            options.segmentCount = ::strtoul(argv[2], nullptr, 10);
+            argc--;
+            argv++;
+        } else if (!::strcmp(argv[1], "-c") && argc > 2) {
+            options.cacheDir = argv[2];
+            argc--;
+            argv++;
+        } else if ((!::strcmp(argv[1], "-T") || !::strcmp(argv[1], "--time-budget")) && argc > 2) {
+            // seconds, optionally with an s or ms suffix
+            char *pUnit = nullptr;
+            options.timeBudget = ::strtod(argv[2], &pUnit);
+            if (!::strcmp(pUnit, "ms"))
+                options.timeBudget /= 1000.0;
+            else if (*pUnit && ::strcmp(pUnit, "s"))
+                options.timeBudget = -1.0;
+
+            if (options.timeBudget <= 0.0) {
+                std::cerr << "Invalid time budget " << argv[2] << std::endl;
+                return -1;
+            }
+            argc--;
+            argv++;
+        } else if (!::strcmp(argv[1], "-f") && argc > 2) {
+            options.output.format = argv[2];
+            argc--;
+            argv++;
+        } else if (!::strcmp(argv[1], "-q") && argc > 2) {
+            options.output.quality = ::atoi(argv[2]);
+            argc--;
+            argv++;
+        } else if (!::strcmp(argv[1], "-z") && argc > 2) {
+            options.output.compressionLevel = ::atoi(argv[2]);
+            argc--;
+            argv++;
+        } else if (!::strcmp(argv[1], "-b")) {
+            batch = true;
+        } else if (!::strcmp(argv[1], "-j") && argc > 2) {
+            workerCount = ::strtoul(argv[2], nullptr, 10);
+            argc--;
+            argv++;
+        } else if (!::strcmp(argv[1], "-S") && argc > 2) {
+            pStateFileName = argv[2];
+            argc--;
+            argv++;
+        } else if (!::strcmp(argv[1], "-D") && argc > 2) {
+            pSocketName = argv[2];
+            argc--;
+            argv++;
+        } else if (!::strcmp(argv[1], "-Q") && argc > 2) {
+            queueLength = ::strtoul(argv[2], nullptr, 10);
+            argc--;
+            argv++;
+        } else {
+            std::cerr << "Unknown option " << argv[1] << std::endl;
+            return -1;
+        }
         argc--;
         argv++;
     }
 
-    av_register_all();
-
-    const char *pStreamName = argv[1];
-    const char *pOverViewName = argv[2];
-
-    // TODO: make these command line parameters
-    size_t thumbWidth   = portrait ? 890 : 320;
-    size_t thumbHeight  = portrait ? 1280 : 200;
-    size_t rowCount     = 6;
-    size_t colCount     = 6;
-
-    size_t thumbCount   = rowCount * colCount;
-
-    vidthumb::Stream* pStream = vidthumb::Stream::Open(pStreamName, thumbWidth, thumbHeight);
-    if (pStream) {
-        std::vector<float>  frameDiffs, frameContrasts, temp;
-        vidthumb::Frame     frames[2];
-
-        vidthumb::Frame*    pCurFrame   = frames + 0;
-        vidthumb::Frame*    pLastFrame  = frames + 1;
-        size_t              curFrame    = 0;
-
-        std::vector<size_t> candidateFrames, selectedFrames;
-
-        float meanDiff = 0.0f;
-        float meanVar = 0.0f;
-        float medianDiff = 0.0f;
-        float medianVar = 0.0f;
-        size_t totalFrames = pStream->GetTotalFrameCount();
-        bool ignoreDiffs = false;
-
-        // read frame differences
-        std::cerr << "Reading "<< totalFrames <<" frame differences..." << std::endl;
-        int pct = 0;
-        while(pStream->GetNextFrame(*pCurFrame, false)) {
-            float diff = curFrame == 0 ? 0 : pCurFrame->GetDifference(pLastFrame);
-            float var  = pCurFrame->GetContrast();
-            frameDiffs.push_back(diff);
-            frameContrasts.push_back(var);
-
-            if (diff < 0.0f)
-                ignoreDiffs = true;
-
-        // std::cerr << diff <<" "<< var << std::endl;
-
-            meanDiff += diff;
-            meanVar += var;
-
-            candidateFrames.push_back(curFrame);
-
-            std::swap(pCurFrame, pLastFrame);
-            curFrame++;
-
-            int newPct = (100.0 * curFrame) / totalFrames;
-            if (newPct != pct) {
-                pct = newPct;
-                if ((pct % 10) == 0)
-                    std::cerr << pct << std::flush;
-                else
-                    std::cerr << "." << std::flush;
-            }
-        }
-
-        std::cerr << std::endl;
-
-        meanDiff /= curFrame;
-        meanVar /= curFrame;
-
-        temp = frameContrasts;
-        std::sort(temp.begin(), temp.end());
-        medianVar = temp[temp.size()/2];
-
-        temp = frameDiffs;
-        std::sort(temp.begin(), temp.end());
-        medianDiff = temp[temp.size()/2];
-
-        auto frameFilter = [&](size_t n){
-            bool remove = frameContrasts[n] < medianVar * 0.5f || (!ignoreDiffs && frameDiffs[n] > medianDiff * 2.0) ;
-            return remove;
-        };
-
-        std::cerr << "mean diff: "<< meanDiff <<" mean variance: " << meanVar << " median variance: "<< medianVar << " median diff: " << medianDiff << std::endl;
-
-        auto it = candidateFrames.begin();
-
-        if (candidateFrames.size() >= thumbCount) 
-        while (it != candidateFrames.end()) {
-            if (frameFilter(*it))
-                it = candidateFrames.erase(it);
-            else 
-                it++;
-        }
-
-        if (thumbCount > candidateFrames.size()) {
-            thumbCount = candidateFrames.size();
-
-            colCount = std::floor( std::sqrt((float)thumbCount) );
-            if (colCount == 0)
-                colCount = 1;
-
-            rowCount = thumbCount / colCount;
-            thumbCount = colCount * rowCount;
-        }
-
-        std::cerr << "Selecting "<< thumbCount <<" frames out of " << candidateFrames.size() <<  " ..." << std::endl;
+    if (argc < (pSocketName ? 1 : batch ? 2 : 3)) {
+        return -1;
+    }
 
-        for (size_t i=0; i<thumbCount; i++) {
-            float f = (float)i / (float)thumbCount;
+    std::string error;
+    if (!vidthumb::CheckOverviewOptions(options, error)) {
+        std::cerr << "Invalid options: " << error << std::endl;
+        return -1;
+    }
 
-            selectedFrames.push_back( candidateFrames[ (size_t)(f * candidateFrames.size()) ]);
-        }
+    if (pSocketName) {
+        vidthumb::Server server(options);
+        if (!server.Listen(pSocketName))
+            return -1;
 
-        std::cerr << "Creating overview "<< pOverViewName <<"..." << std::endl;
+        pServer = &server;
+        ::signal(SIGINT,  StopServer);
+        ::signal(SIGTERM, StopServer);
 
-        for (size_t i=0; i<thumbCount; i++) {
-            std::cerr << i << ": " << selectedFrames[i] << std::endl;
-        }
+        bool success = server.Run(workerCount, queueLength);
+        pServer = nullptr;
+        return success ? 0 : -1;
+    }
 
-        if (colCount < rowCount)
-            std::swap(colCount, rowCount);
-
-        cairo_surface_t* pOverviewSurface = nullptr;
-    
-        pOverviewSurface = cairo_image_surface_create(
-            CAIRO_FORMAT_RGB24, 
-            thumbWidth * colCount, 
-            thumbHeight * rowCount
-        );
-
-        cairo_t* pCairo = cairo_create(pOverviewSurface);
-
-        size_t thumbIndex = 0;
-
-        curFrame = 0;
-        pStream->Rewind();
-        std::swap(pCurFrame, pLastFrame);
-            
-        while(thumbIndex < selectedFrames.size()) {
-            if (curFrame < selectedFrames[thumbIndex]) {
-                // skip frame
-                if (!pStream->SkipNextFrame()) {
-                    break;
-                }
-            } else {
-                // get frame
-                if (!pStream->GetNextFrame(*pCurFrame, true)) {
-                    break;   
-                }
-
-                std::cerr << thumbIndex << ": " << curFrame << " " << frameContrasts[curFrame] << std::endl;
-
-                cairo_surface_t* pThumbSurface = (cairo_surface_t*)pCurFrame->CreateCairoSurface();
-                size_t thumbX = thumbWidth *  (thumbIndex % colCount);
-                size_t thumbY = thumbHeight * (thumbIndex / colCount);
-
-                cairo_set_source_surface(pCairo, pThumbSurface,     thumbX, thumbY);
-                cairo_rectangle(pCairo, thumbX, thumbY, thumbWidth, thumbHeight);
-                cairo_fill(pCairo);
-                thumbIndex++;
-
-                cairo_surface_destroy(pThumbSurface);
-                //if ((thumbIndex%colCount) == 0)
-                //    cairo_surface_write_to_png(pOverviewSurface, pOverViewName);
-
-            } 
-            curFrame++;
-        }
+    if (batch) {
+        const char *pBatchName = argv[1];
+        vidthumb::Batch batchJobs(options);
 
-        cairo_surface_write_to_png(pOverviewSurface, pOverViewName);
+        // a directory is scanned, anything else is read as a manifest
+        struct stat batchStat;
+        bool isDirectory = ::stat(pBatchName, &batchStat) == 0 && S_ISDIR(batchStat.st_mode);
+        if (isDirectory ? !batchJobs.AddDirectory(pBatchName) : !batchJobs.AddManifest(pBatchName))
+            return -1;
 
-        cairo_destroy(pCairo);
-        cairo_surface_destroy(pOverviewSurface);
+        std::string stateFileName = pStateFileName ? pStateFileName :
+            isDirectory ? std::string(pBatchName) + "/.vidthumb-state" : std::string(pBatchName) + ".state";
+        batchJobs.LoadState(stateFileName.c_str());
 
-        delete pStream;
-        pStream = nullptr;
+        return batchJobs.Run(workerCount) == 0 ? 0 : -1;
     }
 
+    const char *pStreamName = argv[1];
+    const char *pOverViewName = argv[2];
 
-    return 0;
-}
\ No newline at end of file
+    return vidthumb::CreateOverview(pStreamName, pOverViewName, options) ? 0 : -1;
+}
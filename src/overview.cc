@@ -0,0 +1,887 @@
+#include "overview.hh"
+#include "analysis_cache.hh"
+#include "frame.hh"
+#include "stream.hh"
+#include "ring_buffer.hh"
+#include "quantile_estimator.hh"
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <thread>
+
+#include <sys/stat.h>
+
+#include <omp.h>
+
+namespace vidthumb {
+
+namespace {
+
+// frames in flight between the decode, scale and analysis stages
+const size_t PipelineDepth = 8;
+const size_t NoSlot = (size_t)-1;
+
+// HQ frames kept per time bucket in single pass mode
+const size_t CandidatesPerBucket = 1;
+
+struct Candidate
+{
+    size_t          frameNum;
+    Frame frame;
+};
+
+// candidates of a single time bucket, highest contrast first
+typedef std::vector<Candidate> CandidateBucket;
+
+void InsertCandidate(CandidateBucket& candidates, Candidate&& candidate, const std::vector<float>& frameContrasts)
+{
+    auto it = std::find_if(candidates.begin(), candidates.end(), [&](const Candidate& other) {
+        return frameContrasts[other.frameNum] < frameContrasts[candidate.frameNum];
+    });
+    candidates.insert(it, std::move(candidate));
+
+    if (candidates.size() > CandidatesPerBucket)
+        candidates.pop_back();
+}
+
+void MergeBuckets(std::vector<CandidateBucket>& buckets, const std::vector<float>& frameContrasts)
+{
+    std::vector<CandidateBucket> merged((buckets.size() + 1) / 2);
+
+    for (size_t i=0; i<buckets.size(); i++) {
+        for (auto& candidate : buckets[i])
+            InsertCandidate(merged[i/2], std::move(candidate), frameContrasts);
+    }
+
+    buckets.swap(merged);
+}
+
+// metrics of one key frame aligned part of the input, the difference of its
+// first frame is filled in from the last frame of the part before
+struct SegmentAnalysis
+{
+    std::vector<float>              frameDiffs;
+    std::vector<float>              frameContrasts;
+    std::vector<double>             frameTimes;
+    std::vector<FrameIndexEntry>    frameIndex;
+
+    Frame                           firstFrame;
+    Frame                           lastFrame;
+    size_t                          decodedFrameCount = 0;
+    bool                            success = false;
+};
+
+void AnalyzeSegment(Stream* pStream, SegmentAnalysis& segment)
+{
+    Frame   frames[2];
+    Frame*  pCurFrame   = frames + 0;
+    Frame*  pLastFrame  = frames + 1;
+
+    while (pStream->GetNextFrame(*pCurFrame, false)) {
+        bool first = segment.frameTimes.empty();
+        segment.frameDiffs.push_back(first ? 0.0f : pCurFrame->GetDifference(pLastFrame));
+        segment.frameContrasts.push_back(pCurFrame->GetContrast());
+        segment.frameTimes.push_back(pStream->GetFrameTime());
+
+        if (first)
+            segment.firstFrame = *pCurFrame;
+
+        std::swap(pCurFrame, pLastFrame);
+    }
+
+    segment.lastFrame  = std::move(*pLastFrame);
+    segment.frameIndex = pStream->GetFrameIndex();
+    segment.success    = true;
+}
+
+// analyse all segments at once, each on its own thread and stream instance
+bool AnalyzeSegments(const Stream* pStream, std::vector<SegmentAnalysis>& segments, size_t threadCount, bool keyFramesOnly)
+{
+    std::vector<std::thread> threads;
+
+    for (size_t i=0; i<segments.size(); i++) {
+        threads.emplace_back([&, i]() {
+            Stream* pSegmentStream = pStream->Clone(threadCount);
+            if (!pSegmentStream)
+                return;
+
+            pSegmentStream->SetKeyFramesOnly(keyFramesOnly);
+            if (pSegmentStream->SetSegment(i, segments.size()))
+                AnalyzeSegment(pSegmentStream, segments[i]);
+
+            segments[i].decodedFrameCount = pSegmentStream->GetDecodedFrameCount();
+            delete pSegmentStream;
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    return std::all_of(segments.begin(), segments.end(), [](const SegmentAnalysis& segment) { return segment.success; });
+}
+
+typedef std::chrono::steady_clock Clock;
+
+// metrics of a frame sampled at some point of the input
+struct Sample
+{
+    double                          time;
+    float                           diff;
+    float                           contrast;
+};
+
+// the part of the time line between two samples, split in the middle when its
+// turn comes; the right end is the end of the input if there is no sample
+struct SampleInterval
+{
+    double                          priority;
+    double                          start;
+    double                          end;
+    size_t                          left;
+    size_t                          right;
+
+    bool                            operator<(const SampleInterval& other) const { return this->priority < other.priority; }
+};
+
+const size_t NoSample = (size_t)-1;
+
+// sample the frame at or after a time, the difference is to the frame after it
+bool SampleFrame(Stream* pStream, double time, Frame frames[2], Sample& sample)
+{
+    if (!pStream->SeekToTime(time) || !pStream->GetNextFrame(frames[0], false))
+        return false;
+
+    sample.time     = pStream->GetFrameTime();
+    sample.contrast = frames[0].GetContrast();
+    sample.diff     = pStream->GetNextFrame(frames[1], false) ? frames[1].GetDifference(&frames[0]) : 0.0f;
+    return true;
+}
+
+// Sample the input evenly at coarseCount points first, then split the 
+// intervals around frames with high difference or contrast first, until 
+// the deadline minus the time fetchRounds more frames are expected to take.
+// The samples are returned in time order.
+bool SampleFrames(Stream* pStream, Clock::time_point deadline, size_t coarseCount, size_t fetchRounds, double minInterval, std::vector<Sample>& samples)
+{
+    double                  duration    = pStream->GetDuration();
+    Clock::time_point       start       = Clock::now();
+    Frame                   frames[2];
+    std::vector<double>     points;
+
+    auto outOfTime = [&]() {
+        if (samples.empty())
+            return false;
+
+        Clock::duration sampleCost = (Clock::now() - start) / samples.size();
+        return Clock::now() + sampleCost * fetchRounds >= deadline;
+    };
+
+    auto addSample = [&](double time) {
+        Sample sample;
+        if (!SampleFrame(pStream, time, frames, sample))
+            return NoSample;
+
+        samples.push_back(sample);
+        points.push_back(time);
+        return samples.size() - 1;
+    };
+
+    // coarse pass, in bit reversed order so that an early stop still covers everything
+    size_t coarseBits = 0;
+    while (((size_t)1 << coarseBits) < coarseCount)
+        coarseBits++;
+
+    for (size_t i=0; i < ((size_t)1 << coarseBits) && !outOfTime(); i++) {
+        size_t point = 0;
+        for (size_t bit=0; bit<coarseBits; bit++)
+            point |= ((i >> bit) & 1) << (coarseBits - 1 - bit);
+
+        if (point < coarseCount)
+            addSample(duration * point / coarseCount);
+    }
+
+    if (samples.empty())
+        return false;
+
+    // weights are relative to the means of the coarse pass, so priorities stay comparable
+    double meanDiff = 0.0, meanContrast = 0.0;
+    for (const Sample& sample : samples) {
+        meanDiff     += std::max(sample.diff, 0.0f) / samples.size();
+        meanContrast += sample.contrast / samples.size();
+    }
+
+    auto weight = [&](size_t n) {
+        const Sample& sample = samples[n];
+        return (meanDiff     > 0.0 ? std::max(sample.diff, 0.0f) / meanDiff : 0.0) +
+               (meanContrast > 0.0 ? sample.contrast / meanContrast : 0.0);
+    };
+
+    std::priority_queue<SampleInterval> intervals;
+    auto addInterval = [&](double intervalStart, double intervalEnd, size_t left, size_t right) {
+        if (intervalEnd - intervalStart < 2.0 * minInterval)
+            return;
+
+        double w = right == NoSample ? 2.0 * weight(left) : weight(left) + weight(right);
+        intervals.push({ (intervalEnd - intervalStart) * (1.0 + w), intervalStart, intervalEnd, left, right });
+    };
+
+    std::vector<size_t> order(samples.size());
+    for (size_t i=0; i<order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return points[a] < points[b]; });
+
+    for (size_t i=0; i<order.size(); i++)
+        addInterval(points[order[i]], i + 1 < order.size() ? points[order[i + 1]] : duration, order[i], i + 1 < order.size() ? order[i + 1] : NoSample);
+
+    // refinement
+    while (!intervals.empty() && !outOfTime()) {
+        SampleInterval interval = intervals.top();
+        intervals.pop();
+
+        double middle = (interval.start + interval.end) / 2.0;
+        size_t sample = addSample(middle);
+        if (sample == NoSample)
+            continue;
+
+        // seeking landed on a frame that is already known, key frames only
+        // or a sparse index, so there is nothing more to find in here
+        if (samples[sample].time == samples[interval.left].time || 
+            (interval.right != NoSample && samples[sample].time == samples[interval.right].time))
+            continue;
+
+        addInterval(interval.start, middle, interval.left, sample);
+        addInterval(middle, interval.end, sample, interval.right);
+    }
+
+    std::sort(samples.begin(), samples.end(), [](const Sample& a, const Sample& b) { return a.time < b.time; });
+    samples.erase(std::unique(samples.begin(), samples.end(), [](const Sample& a, const Sample& b) { return a.time == b.time; }), samples.end());
+    return true;
+}
+
+// Collects the overview's rows for the caller instead of encoding them.
+class SurfaceWriter : public ImageWriter
+{
+public:
+
+                        SurfaceWriter(OverviewSurface& surface) :
+                            ImageWriter { "", ImageWriterOptions() },
+                            Surface     ( surface ),
+                            RowsWritten { 0 }
+                        {
+                        }
+
+    bool                Begin(size_t width, size_t height) override
+    {
+        this->Surface.width  = width;
+        this->Surface.height = height;
+        this->Surface.stride = width * 4;
+        this->Surface.pixels.resize(this->Surface.stride * height);
+        this->RowsWritten = 0;
+        return true;
+    }
+
+    bool                WriteRows(const uint8_t* pRows, size_t rowCount, size_t stride) override
+    {
+        rowCount = std::min(rowCount, this->Surface.height - this->RowsWritten);
+        for (size_t y=0; y<rowCount; y++, this->RowsWritten++)
+            ::memcpy(this->Surface.pixels.data() + this->RowsWritten * this->Surface.stride, pRows + y*stride, this->Surface.stride);
+        return true;
+    }
+
+    bool                End() override
+    {
+        return this->RowsWritten == this->Surface.height;
+    }
+
+private:
+
+    OverviewSurface&    Surface;
+    size_t              RowsWritten;
+};
+
+}
+
+bool CheckOverviewOptions(const OverviewOptions& options, std::string& error)
+{
+    size_t thumbWidth   = options.thumbWidth  ? options.thumbWidth  : options.portrait ? 890 : 320;
+    size_t thumbHeight  = options.thumbHeight ? options.thumbHeight : options.portrait ? 1280 : 200;
+
+    if (options.columns > MaxThumbnailCount || options.rows > MaxThumbnailCount || options.columns * options.rows > MaxThumbnailCount) {
+        error = "too many thumbnails, at most " + std::to_string(MaxThumbnailCount);
+        return false;
+    }
+
+    if (thumbWidth > MaxThumbnailSize || thumbHeight > MaxThumbnailSize) {
+        error = "thumbnails too large, at most " + std::to_string(MaxThumbnailSize) + " pixels";
+        return false;
+    }
+
+    if (thumbWidth * options.columns > MaxOverviewSize || thumbHeight * options.rows > MaxOverviewSize) {
+        error = "overview too large, at most " + std::to_string(MaxOverviewSize) + " pixels";
+        return false;
+    }
+
+    return true;
+}
+
+typedef std::function<ImageWriter*(const ImageWriterOptions& options)> WriterFactory;
+
+// the writer is created once the thumbnails are known, pOutputName only names
+// the output in messages
+static bool CreateOverview(const StreamInput& input, const char *pOutputName, const WriterFactory& createWriter, const OverviewOptions& options)
+{
+    // the time budget includes opening the input
+    Clock::time_point overviewStart = Clock::now();
+
+    // progress goes nowhere unless asked for
+    std::ostream nullStream(nullptr);
+    std::ostream& log = options.verbose ? std::cerr : nullStream;
+
+    std::string error;
+    if (!CheckOverviewOptions(options, error)) {
+        log << "Invalid options: " << error << "." << std::endl;
+        return false;
+    }
+
+    size_t thumbWidth   = options.thumbWidth  ? options.thumbWidth  : options.portrait ? 890 : 320;
+    size_t thumbHeight  = options.thumbHeight ? options.thumbHeight : options.portrait ? 1280 : 200;
+    size_t rowCount     = std::max<size_t>(options.rows, 1);
+    size_t colCount     = std::max<size_t>(options.columns, 1);
+
+    size_t thumbCount   = rowCount * colCount;
+
+    Stream* pStream = Stream::Open(input, thumbWidth, thumbHeight, options.threadCount);
+    if (!pStream) {
+        log << "Could not open " << input.GetName() << "." << std::endl;
+        return false;
+    }
+
+    pStream->SetKeyFramesOnly(options.keyFramesOnly);
+    pStream->SetAnalysisSize(options.analysisWidth, options.analysisHeight);
+
+    std::vector<float>  frameDiffs, frameContrasts;
+    std::vector<double> frameTimes;
+    size_t              curFrame    = 0;
+
+    // by all streams of this input, reported at the end
+    size_t              decodedFrameCount = 0;
+
+    std::vector<size_t> selectedFrames;
+
+    // medians are estimated as the frames come in
+    QuantileEstimator   medianDiffEstimator, medianVarEstimator;
+
+    float meanDiff = 0.0f;
+    float meanVar = 0.0f;
+    float medianDiff = 0.0f;
+    float medianVar = 0.0f;
+    size_t totalFrames = pStream->GetTotalFrameCount();
+    bool ignoreDiffs = false;
+
+    // single pass: keep the best HQ frame of each time bucket, merging
+    // neighbouring buckets whenever the estimated frame count turns out to
+    // be too low, so at most twice as many frames as thumbnails are held
+    std::vector<CandidateBucket> buckets;
+    size_t bucketSize = std::max<size_t>(1, (totalFrames + thumbCount - 1) / thumbCount);
+
+    // metrics of a cached analysis are used in place, the decoded ones from the vectors
+    AnalysisCache   cache;
+    AnalysisKey     cacheKey;
+    std::string     cacheFileName;
+    bool            cached = false;
+
+    if (!options.cacheDir.empty() && input.IsFile() && GetFileFingerprint(input.fileName.c_str(), cacheKey.file)) {
+        cacheKey.analysisWidth  = options.analysisWidth;
+        cacheKey.analysisHeight = options.analysisHeight;
+        cacheKey.keyFramesOnly  = options.keyFramesOnly;
+
+        cacheFileName = AnalysisCache::GetFileName(options.cacheDir.c_str(), cacheKey);
+        cached = cache.Load(cacheFileName.c_str(), cacheKey);
+    }
+
+    // with a time budget the input is sampled instead of read in full,
+    // a complete cached analysis is still better and costs nothing
+    bool sampling = options.timeBudget > 0.0 && !cached && pStream->GetDuration() > 0.0 && input.IsSeekable();
+    bool sampled  = false;
+
+    // there are no HQ candidates without decoding, so fall back to seeking for the thumbnails
+    // and inputs that can only be read once have to be done in a single pass
+    bool singlePass = (options.singlePass || !input.IsSeekable()) && !cached && !sampling;
+
+    // an explicit thread count also bounds this, so batch workers don't oversubscribe
+    int fetchThreads = options.threadCount ? options.threadCount : omp_get_max_threads();
+    fetchThreads = std::max<int>(1, std::min<int>(fetchThreads, thumbCount));
+
+    const float*  pFrameDiffs     = nullptr;
+    const float*  pFrameContrasts = nullptr;
+    const double* pFrameTimes     = nullptr;
+
+    if (cached) {
+        log << "Using cached analysis of " << cache.GetFrameCount() << " frames." << std::endl;
+
+        pFrameDiffs     = cache.GetDifferences();
+        pFrameContrasts = cache.GetContrasts();
+        pFrameTimes     = cache.GetFrameTimes();
+
+        for (curFrame = 0; curFrame < cache.GetFrameCount(); curFrame++) {
+            if (pFrameDiffs[curFrame] < 0.0f)
+                ignoreDiffs = true;
+
+            meanDiff += pFrameDiffs[curFrame];
+            meanVar += pFrameContrasts[curFrame];
+            medianDiffEstimator.Add(pFrameDiffs[curFrame]);
+            medianVarEstimator.Add(pFrameContrasts[curFrame]);
+        }
+
+        // lets the thumbnails be fetched by seeking straight away
+        pStream->SetFrameIndex(cache.GetFrameIndex());
+    } else {
+        // read frame differences
+        log << "Reading "<< totalFrames <<" frame differences..." << std::endl;
+        int pct = 0;
+
+        auto addFrame = [&](float diff, float var, double frameTime) {
+            frameDiffs.push_back(diff);
+            frameContrasts.push_back(var);
+            frameTimes.push_back(frameTime);
+
+            if (diff < 0.0f)
+                ignoreDiffs = true;
+
+        // log << diff <<" "<< var << std::endl;
+
+            if (singlePass) {
+                while (curFrame / bucketSize >= 2 * thumbCount) {
+                    MergeBuckets(buckets, frameContrasts);
+                    bucketSize *= 2;
+                }
+
+                size_t bucket = curFrame / bucketSize;
+                if (buckets.size() <= bucket)
+                    buckets.resize(bucket + 1);
+
+                // frames that are likely to be dropped by the filter below 
+                // are not worth an extra HQ scale
+                bool isCandidate = curFrame == 0 || ignoreDiffs || diff <= 2.0 * medianDiffEstimator.Get();
+                CandidateBucket& candidates = buckets[bucket];
+
+                if (isCandidate && (candidates.size() < CandidatesPerBucket || var > frameContrasts[candidates.back().frameNum])) {
+                    Candidate candidate;
+                    candidate.frameNum = curFrame;
+                    if (pStream->GetCurrentFrame(candidate.frame, true))
+                        InsertCandidate(candidates, std::move(candidate), frameContrasts);
+                }
+            }
+
+            meanDiff += diff;
+            meanVar += var;
+            medianDiffEstimator.Add(diff);
+            medianVarEstimator.Add(var);
+
+            curFrame++;
+
+            if (totalFrames == 0)
+                return;
+
+            int newPct = (100.0 * curFrame) / totalFrames;
+            if (newPct != pct) {
+                pct = newPct;
+                if ((pct % 10) == 0)
+                    log << pct << std::flush;
+                else
+                    log << "." << std::flush;
+            }
+        };
+
+        auto analyzeFrame = [&](const Frame& frame, const Frame& lastFrame, double frameTime) {
+            addFrame(curFrame == 0 ? 0 : frame.GetDifference(&lastFrame), frame.GetContrast(), frameTime);
+        };
+
+        std::vector<Sample> samples;
+        if (sampling) {
+            log << "Sampling for " << options.timeBudget << "s..." << std::endl;
+
+            Clock::time_point deadline = overviewStart + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.timeBudget));
+            size_t fetchRounds = (thumbCount + fetchThreads - 1) / fetchThreads;
+            double minInterval = totalFrames ? pStream->GetDuration() / totalFrames : 0.0;
+
+            sampled = SampleFrames(pStream, deadline, 2 * thumbCount, fetchRounds, minInterval, samples);
+            if (!sampled)
+                pStream->Rewind();
+        }
+
+        // long inputs are split at key frames and the parts analysed on all cores,
+        // single pass mode needs the stream to stay in step with the analysis
+        size_t maxSegments = options.segmentCount ? options.segmentCount : std::thread::hardware_concurrency();
+        std::vector<SegmentAnalysis> segments(singlePass || sampled ? 1 : pStream->GetSegmentCount(maxSegments));
+        bool segmented = segments.size() > 1 && AnalyzeSegments(pStream, segments, options.threadCount ? options.threadCount : 1, options.keyFramesOnly);
+        for (const SegmentAnalysis& segment : segments)
+            decodedFrameCount += segment.decodedFrameCount;
+
+        // demux and decode on the stream's own thread
+        pStream->SetDecodeAhead(PipelineDepth);
+
+        if (sampled) {
+            totalFrames = samples.size();
+            for (const Sample& sample : samples)
+                addFrame(sample.diff, sample.contrast, sample.time);
+        } else if (segmented) {
+            std::vector<FrameIndexEntry> frameIndex;
+            const SegmentAnalysis* pLastSegment = nullptr;
+
+            for (auto& segment : segments) {
+                if (!segment.frameTimes.empty() && pLastSegment)
+                    segment.frameDiffs[0] = segment.firstFrame.GetDifference(&pLastSegment->lastFrame);
+
+                for (size_t i=0; i<segment.frameTimes.size(); i++)
+                    addFrame(segment.frameDiffs[i], segment.frameContrasts[i], segment.frameTimes[i]);
+
+                frameIndex.insert(frameIndex.end(), segment.frameIndex.begin(), segment.frameIndex.end());
+                if (!segment.frameTimes.empty())
+                    pLastSegment = &segment;
+            }
+
+            // the frames have not been read through this stream, so seeking needs the index
+            if (frameIndex.size() == curFrame)
+                pStream->SetFrameIndex(frameIndex);
+        } else if (singlePass) {
+            // candidates are scaled from the stream's current frame, so 
+            // analysis has to stay in step with the stream
+            Frame   frames[2];
+            Frame*  pCurFrame   = frames + 0;
+            Frame*  pLastFrame  = frames + 1;
+
+            while(pStream->GetNextFrame(*pCurFrame, false)) {
+                analyzeFrame(*pCurFrame, *pLastFrame, pStream->GetFrameTime());
+                std::swap(pCurFrame, pLastFrame);
+            }
+        } else {
+            // scale on a second thread while the metrics are computed on this one
+            std::vector<Frame>  slots(PipelineDepth + 2);
+            std::vector<double> slotTimes(slots.size());
+            RingBuffer<size_t>  freeSlots(slots.size());
+            RingBuffer<size_t>  scaledSlots(slots.size() + 1);
+
+            for (size_t i=0; i<slots.size(); i++)
+                freeSlots.Push(i);
+
+            std::thread scaleThread([&]() {
+                for (;;) {
+                    size_t slot = freeSlots.Pop();
+                    if (!pStream->GetNextFrame(slots[slot], false))
+                        break;
+
+                    slotTimes[slot] = pStream->GetFrameTime();
+                    scaledSlots.Push(slot);
+                }
+                scaledSlots.Push(NoSlot);
+            });
+
+            size_t lastSlot = NoSlot;
+            for (;;) {
+                size_t slot = scaledSlots.Pop();
+                if (slot == NoSlot)
+                    break;
+
+                analyzeFrame(slots[slot], slots[lastSlot != NoSlot ? lastSlot : slot], slotTimes[slot]);
+
+                if (lastSlot != NoSlot)
+                    freeSlots.Push(lastSlot);
+                lastSlot = slot;
+            }
+
+            scaleThread.join();
+        }
+
+        // the selected frames are fetched by seeking, reading ahead would be wasted
+        pStream->SetDecodeAhead(0);
+
+        log << std::endl;
+
+        pFrameDiffs     = frameDiffs.data();
+        pFrameContrasts = frameContrasts.data();
+        pFrameTimes     = frameTimes.data();
+
+        // a sampled analysis is incomplete, so it is not worth keeping
+        if (!cacheFileName.empty() && curFrame > 0 && !sampled) {
+            ::mkdir(options.cacheDir.c_str(), 0777);
+            AnalysisCache::Save(cacheFileName.c_str(), cacheKey, curFrame, pFrameDiffs, pFrameContrasts, pFrameTimes, pStream->GetFrameIndex());
+        }
+    }
+
+    if (curFrame == 0) {
+        log << "No frames could be read." << std::endl;
+        delete pStream;
+        return false;
+    }
+
+    meanDiff /= curFrame;
+    meanVar /= curFrame;
+
+    medianVar = medianVarEstimator.Get();
+    medianDiff = medianDiffEstimator.Get();
+
+    auto frameFilter = [&](size_t n){
+        bool remove = pFrameContrasts[n] < medianVar * 0.5f || (!ignoreDiffs && pFrameDiffs[n] > medianDiff * 2.0) ;
+        return remove;
+    };
+
+    log << "mean diff: "<< meanDiff <<" mean variance: " << meanVar << " median variance: "<< medianVar << " median diff: " << medianDiff << std::endl;
+
+    // in single pass mode the candidates are the best surviving frame of each bucket
+    std::vector<const Candidate*> bucketCandidates;
+    if (singlePass) {
+        for (auto& candidates : buckets) {
+            if (candidates.empty())
+                continue;
+
+            auto best = std::find_if(candidates.begin(), candidates.end(), [&](const Candidate& candidate) { 
+                return !frameFilter(candidate.frameNum); 
+            });
+            if (best == candidates.end())
+                best = candidates.begin();
+
+            bucketCandidates.push_back(&*best);
+        }
+    }
+
+    // candidates are the bucket candidates or the frames that pass the filter,
+    // walked over in order instead of being collected
+    size_t candidateTotal   = singlePass ? bucketCandidates.size() : curFrame;
+    bool   filterCandidates = !singlePass && curFrame >= thumbCount;
+
+    auto isCandidate = [&](size_t n) {
+        return !filterCandidates || !frameFilter(n);
+    };
+
+    auto nextCandidate = [&](size_t n) {
+        do {
+            n++;
+        } while (n < candidateTotal && !isCandidate(n));
+        return n;
+    };
+
+    size_t candidateCount = 0, firstCandidate = 0, lastCandidate = 0;
+    for (size_t n=0; n<candidateTotal; n++) {
+        if (!isCandidate(n))
+            continue;
+
+        if (candidateCount++ == 0)
+            firstCandidate = n;
+        lastCandidate = n;
+    }
+
+    if (thumbCount > candidateCount) {
+        thumbCount = candidateCount;
+
+        colCount = std::floor( std::sqrt((float)thumbCount) );
+        if (colCount == 0)
+            colCount = 1;
+
+        rowCount = thumbCount / colCount;
+        thumbCount = colCount * rowCount;
+
+        // the smaller grid is wider than high
+        std::swap(colCount, rowCount);
+    }
+
+    log << "Selecting "<< thumbCount <<" frames out of " << candidateCount <<  " ..." << std::endl;
+
+    // spread the thumbnails evenly over the time line, which is not the 
+    // same as evenly over the frames when only key frames are read
+    auto candidateTime = [&](size_t candidate) {
+        return pFrameTimes[ singlePass ? bucketCandidates[candidate]->frameNum : candidate ];
+    };
+
+    double startTime = candidateCount == 0 ? 0.0 : candidateTime(firstCandidate);
+    double duration  = candidateCount == 0 ? 0.0 : candidateTime(lastCandidate) - startTime;
+
+    // n is candidate number rank, enough candidates are left for the remaining thumbnails
+    size_t n = firstCandidate, rank = 0;
+
+    for (size_t i=0; i<thumbCount; i++) {
+        double t = startTime + duration * i / thumbCount;
+
+        while (rank < candidateCount - (thumbCount - i) && candidateTime(n) < t) {
+            n = nextCandidate(n);
+            rank++;
+        }
+
+        selectedFrames.push_back(n);
+        n = nextCandidate(n);
+        rank++;
+    }
+
+    log << "Creating overview "<< pOutputName <<"..." << std::endl;
+
+    for (size_t i=0; i<thumbCount; i++) {
+        log << i << ": " << selectedFrames[i] << " @ " << candidateTime(selectedFrames[i]) << "s" << std::endl;
+    }
+
+    // the overview is put together and written one band of thumbnails at a
+    // time, so only a band is ever held in memory
+    size_t overviewWidth  = thumbWidth * colCount;
+    size_t overviewHeight = thumbHeight * rowCount;
+    Frame  band(overviewWidth, thumbHeight);
+
+    ImageWriterOptions writerOptions = options.output;
+    if (!writerOptions.threadCount)
+        writerOptions.threadCount = options.threadCount;
+
+    ImageWriter* pWriter = createWriter(writerOptions);
+    if (!pWriter) {
+        log << "Unsupported output format for " << pOutputName << "." << std::endl;
+        delete pStream;
+        return false;
+    }
+
+    // thumbnails are scaled straight into their cell of the band, frames
+    // of another size are copied in, cut off at the cell's edges
+    auto getCell = [&](size_t thumbIndex, size_t width, size_t height) {
+        size_t thumbX = thumbWidth * (thumbIndex % colCount);
+
+        return Frame::View(band.GetData() + thumbX*4, width, height, band.GetStride());
+    };
+
+    auto drawThumb = [&](const Frame& frame, size_t thumbIndex) {
+        Frame cell = getCell(thumbIndex, std::min(frame.GetWidth(), thumbWidth), std::min(frame.GetHeight(), thumbHeight));
+        if (cell.GetData() == frame.GetData())
+            return;
+
+        for (size_t y=0; y<cell.GetHeight(); y++)
+            ::memcpy(cell.GetData() + y*cell.GetStride(), frame.GetData() + y*frame.GetStride(), cell.GetWidth()*4);
+    };
+
+    // sampled frames have no frame numbers, only times
+    auto seekToThumb = [&](Stream* pThumbStream, size_t thumbIndex) {
+        size_t frame = selectedFrames[thumbIndex];
+        return sampled ? pThumbStream->SeekToTime(pFrameTimes[frame]) : pThumbStream->SeekToFrame(frame);
+    };
+
+    // each fetch thread seeks on its own stream, kept for all bands
+    std::vector<Stream*> threadStreams;
+    if (!singlePass) {
+        fetchThreads = std::max<int>(1, std::min<int>(fetchThreads, colCount));
+
+        threadStreams.push_back(pStream);
+        for (int i=1; i<fetchThreads; i++) {
+            Stream* pThreadStream = pStream->Clone();
+            if (pThreadStream)
+                pThreadStream->SetKeyFramesOnly(options.keyFramesOnly);
+            threadStreams.push_back(pThreadStream);
+        }
+    }
+
+    bool written = pWriter->Begin(overviewWidth, overviewHeight);
+
+    for (size_t row=0; row<rowCount && written; row++) {
+        size_t firstThumb = row * colCount;
+        size_t lastThumb  = std::min(firstThumb + colCount, selectedFrames.size());
+
+        for (size_t y=0; y<band.GetHeight(); y++)
+            ::memset(band.GetData() + y*band.GetStride(), 0, overviewWidth*4);
+
+        if (singlePass) {
+            for (size_t thumbIndex=firstThumb; thumbIndex<lastThumb; thumbIndex++) {
+                const Candidate* pCandidate = bucketCandidates[selectedFrames[thumbIndex]];
+                log << thumbIndex << ": " << pCandidate->frameNum << " " << pFrameContrasts[pCandidate->frameNum] << std::endl;
+                drawThumb(pCandidate->frame, thumbIndex);
+            }
+        } else {
+            // fetch into views of the cells as long as the stream's frames fit
+            std::vector<Frame> thumbs;
+            std::vector<char>  fetched(lastThumb - firstThumb, false);
+            for (size_t thumbIndex=firstThumb; thumbIndex<lastThumb; thumbIndex++)
+                thumbs.push_back(getCell(thumbIndex, std::min(pStream->GetTargetWidth(), thumbWidth), std::min(pStream->GetTargetHeight(), thumbHeight)));
+
+            #pragma omp parallel for num_threads(fetchThreads) schedule(dynamic)
+            for (size_t i=0; i<thumbs.size(); i++) {
+                Stream* pThreadStream = threadStreams[omp_get_thread_num()];
+                if (pThreadStream && seekToThumb(pThreadStream, firstThumb + i))
+                    fetched[i] = pThreadStream->GetNextFrame(thumbs[i], true);
+            }
+
+            for (size_t i=0; i<thumbs.size(); i++) {
+                size_t thumbIndex = firstThumb + i;
+
+                // input could not be opened again, fall back to the main stream
+                if (!fetched[i] && (!seekToThumb(pStream, thumbIndex) || !pStream->GetNextFrame(thumbs[i], true)))
+                    continue;
+
+                log << thumbIndex << ": " << selectedFrames[thumbIndex] << " " << pFrameContrasts[selectedFrames[thumbIndex]] << std::endl;
+                drawThumb(thumbs[i], thumbIndex);
+            }
+        }
+
+        written = pWriter->WriteRows(band.GetData(), band.GetHeight(), band.GetStride());
+    }
+
+    written = written && pWriter->End();
+    if (!written)
+        log << "Could not write " << pOutputName << "." << std::endl;
+
+    delete pWriter;
+
+    for (Stream* pThreadStream : threadStreams) {
+        if (pThreadStream && pThreadStream != pStream)
+            decodedFrameCount += pThreadStream->GetDecodedFrameCount();
+        if (pThreadStream != pStream)
+            delete pThreadStream;
+    }
+
+    // read by the throughput checks, keep the wording
+    decodedFrameCount += pStream->GetDecodedFrameCount();
+    log << "Decoded " << decodedFrameCount << " frames in " << std::chrono::duration<double>(Clock::now() - overviewStart).count() << "s." << std::endl;
+
+    delete pStream;
+
+    return written;
+}
+
+bool CreateOverview(const char *pInputName, const char *pOutputName, const OverviewOptions& options)
+{
+    return CreateOverview(StreamInput::FromFile(pInputName), pOutputName, [&](const ImageWriterOptions& writerOptions) {
+        return ImageWriter::Create(pOutputName, writerOptions);
+    }, options);
+}
+
+bool CreateOverview(const char *pInputName, FILE* pOutput, const OverviewOptions& options)
+{
+    return CreateOverview(StreamInput::FromFile(pInputName), "output", [&](const ImageWriterOptions& writerOptions) {
+        return ImageWriter::Create(pOutput, writerOptions);
+    }, options);
+}
+
+bool CreateOverview(const StreamInput& input, std::vector<uint8_t>& image, const OverviewOptions& options)
+{
+    char*  pData = nullptr;
+    size_t size  = 0;
+    FILE*  pOutput = open_memstream(&pData, &size);
+    if (!pOutput)
+        return false;
+
+    bool success = CreateOverview(input, "output", [&](const ImageWriterOptions& writerOptions) {
+        return ImageWriter::Create(pOutput, writerOptions);
+    }, options);
+    success = fclose(pOutput) == 0 && success;
+
+    image.assign(pData, pData + (success ? size : 0));
+    free(pData);
+    return success;
+}
+
+bool CreateOverview(const StreamInput& input, OverviewSurface& surface, const OverviewOptions& options)
+{
+    return CreateOverview(input, "surface", [&](const ImageWriterOptions&) {
+        return new SurfaceWriter(surface);
+    }, options);
+}
+
+}
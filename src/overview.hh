@@ -0,0 +1,85 @@
+#pragma once
+
+#include "image_writer.hh"
+#include "stream.hh"
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace vidthumb 
+{
+
+struct OverviewOptions
+{
+    bool                portrait        = false;
+    bool                singlePass      = false;
+    bool                keyFramesOnly   = false;
+
+    // thumbnails across and down
+    size_t              columns         = 6;
+    size_t              rows            = 6;
+
+    // size of a thumbnail, 0 for 320x200 or 890x1280 in portrait mode
+    size_t              thumbWidth      = 0;
+    size_t              thumbHeight     = 0;
+
+    // decoder threads per stream, 0 for one per core
+    size_t              threadCount     = 0;
+
+    // parts a single input is split into for analysis, 0 for one per core
+    size_t              segmentCount    = 0;
+
+    size_t              analysisWidth   = 64;
+    size_t              analysisHeight  = 36;
+
+    // directory the per frame metrics are kept in between runs, none if empty
+    std::string         cacheDir;
+
+    // seconds to create the overview in, sampling the input instead of
+    // reading all of it; 0 for no limit
+    double              timeBudget      = 0.0;
+
+    // format and encoder settings of the overview image, PNG threads default
+    // to the thread count above
+    ImageWriterOptions  output;
+
+    // report progress on stderr
+    bool                verbose         = true;
+};
+
+// the largest grid, thumbnail and overview accepted, so an overview fits in
+// memory and in every output format
+const size_t            MaxThumbnailCount   = 1024;
+const size_t            MaxThumbnailSize    = 4096;
+const size_t            MaxOverviewSize     = 16383;
+
+// false with the reason if the options ask for more than the above
+bool CheckOverviewOptions(const OverviewOptions& options, std::string& error);
+
+// an overview that was not encoded, 32 bit pixels as cairo's RGB24 format
+// has them, rows top to bottom
+struct OverviewSurface
+{
+    size_t              width           = 0;
+    size_t              height          = 0;
+    size_t              stride          = 0;
+    std::vector<uint8_t> pixels;
+};
+
+// analyse one input and write its overview image, false if either failed
+bool CreateOverview(const char *pInputName, const char *pOutputName, const OverviewOptions& options);
+
+// same, but write the overview into an open file, in the format the output
+// options ask for
+bool CreateOverview(const char *pInputName, FILE* pOutput, const OverviewOptions& options);
+
+// same for an input in a file, in memory or read through callbacks, with
+// the encoded overview or its pixels returned in memory; inputs that can't
+// be sought are read in a single pass
+bool CreateOverview(const StreamInput& input, std::vector<uint8_t>& image, const OverviewOptions& options);
+bool CreateOverview(const StreamInput& input, OverviewSurface& surface, const OverviewOptions& options);
+
+}
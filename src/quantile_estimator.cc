@@ -0,0 +1,97 @@
+#include "quantile_estimator.hh"
+
+#include <algorithm>
+
+namespace vidthumb {
+
+QuantileEstimator::QuantileEstimator(double quantile) :
+    Quantile                    { quantile },
+    Count                       { 0 },
+    Heights                     { 0.0, 0.0, 0.0, 0.0, 0.0 },
+    Positions                   { 1.0, 2.0, 3.0, 4.0, 5.0 },
+    DesiredPositions            { 1.0, 1.0 + 2.0*quantile, 1.0 + 4.0*quantile, 3.0 + 2.0*quantile, 5.0 },
+    Increments                  { 0.0, quantile / 2.0, quantile, (1.0 + quantile) / 2.0, 1.0 }
+{
+}
+
+void QuantileEstimator::Add(double value)
+{
+    if (this->Count < 5) {
+        this->Heights[this->Count++] = value;
+        if (this->Count == 5)
+            std::sort(this->Heights, this->Heights + 5);
+        return;
+    }
+    this->Count++;
+
+    // find the cell the value falls into, extending the range if needed
+    size_t cell;
+    if (value < this->Heights[0]) {
+        this->Heights[0] = value;
+        cell = 0;
+    } else if (value >= this->Heights[4]) {
+        this->Heights[4] = value;
+        cell = 3;
+    } else {
+        cell = 0;
+        while (value >= this->Heights[cell + 1])
+            cell++;
+    }
+
+    for (size_t i=cell + 1; i<5; i++)
+        this->Positions[i] += 1.0;
+
+    for (size_t i=0; i<5; i++)
+        this->DesiredPositions[i] += this->Increments[i];
+
+    // move the middle markers towards their desired positions
+    for (size_t i=1; i<4; i++) {
+        double d = this->DesiredPositions[i] - this->Positions[i];
+
+        if ((d >= 1.0 && this->Positions[i + 1] - this->Positions[i] > 1.0) ||
+            (d <= -1.0 && this->Positions[i - 1] - this->Positions[i] < -1.0)) {
+            int    step   = d > 0.0 ? 1 : -1;
+            double height = this->Parabolic(i, step);
+
+            if (this->Heights[i - 1] < height && height < this->Heights[i + 1])
+                this->Heights[i] = height;
+            else
+                this->Heights[i] = this->Linear(i, step);
+
+            this->Positions[i] += step;
+        }
+    }
+}
+
+double QuantileEstimator::Get() const
+{
+    if (this->Count >= 5)
+        return this->Heights[2];
+
+    if (this->Count == 0)
+        return 0.0;
+
+    // exact for the few values seen so far
+    double sorted[5];
+    std::copy(this->Heights, this->Heights + this->Count, sorted);
+    std::sort(sorted, sorted + this->Count);
+    return sorted[std::min<size_t>(this->Count * this->Quantile, this->Count - 1)];
+}
+
+double QuantileEstimator::Parabolic(size_t i, double d) const
+{
+    const double* q = this->Heights;
+    const double* n = this->Positions;
+
+    return q[i] + d / (n[i + 1] - n[i - 1]) * (
+        (n[i] - n[i - 1] + d) * (q[i + 1] - q[i]) / (n[i + 1] - n[i]) +
+        (n[i + 1] - n[i] - d) * (q[i] - q[i - 1]) / (n[i] - n[i - 1])
+    );
+}
+
+double QuantileEstimator::Linear(size_t i, int d) const
+{
+    return this->Heights[i] + d * (this->Heights[i + d] - this->Heights[i]) / (this->Positions[i + d] - this->Positions[i]);
+}
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+
+namespace vidthumb 
+{
+
+// Running estimate of a quantile in constant memory, using the P² algorithm
+// by Jain and Chlamtac. The first five values are kept, after that five 
+// markers approximate the quantile and its neighbourhood.
+class QuantileEstimator
+{
+public:
+
+                        QuantileEstimator(double quantile = 0.5);
+
+    void                Add(double value);
+    double              Get() const;
+
+    size_t              GetCount() const { return this->Count; }
+
+private:
+
+    double              Quantile;
+    size_t              Count;
+
+    // marker heights, actual and desired positions
+    double              Heights[5];
+    double              Positions[5];
+    double              DesiredPositions[5];
+    double              Increments[5];
+
+    double              Parabolic(size_t i, double d) const;
+    double              Linear(size_t i, int d) const;
+};
+
+}
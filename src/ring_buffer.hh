@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace vidthumb
+{
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// The blocking variants sleep on a condition variable once the queue is full
+// or empty, the other side only takes the lock when someone is waiting.
+template<typename T>
+class RingBuffer
+{
+public:
+
+                        RingBuffer(size_t capacity = 0) :
+                            Items       ( capacity + 1 ),
+                            Head        { 0 },
+                            Tail        { 0 },
+                            Waiting     { 0 }
+                        {
+                        }
+
+    bool                TryPush(const T& item)
+    {
+        if (!this->Put(item))
+            return false;
+
+        this->Wake();
+        return true;
+    }
+
+    bool                TryPop(T& item)
+    {
+        if (!this->Take(item))
+            return false;
+
+        this->Wake();
+        return true;
+    }
+
+    void                Push(const T& item)
+    {
+        if (this->TryPush(item))
+            return;
+
+        this->Wait([&]() { return this->Put(item); });
+        this->Wake();
+    }
+
+    T                   Pop()
+    {
+        T item;
+        if (this->TryPop(item))
+            return item;
+
+        this->Wait([&]() { return this->Take(item); });
+        this->Wake();
+        return item;
+    }
+
+    // only safe while neither side is running
+    void                Reset(size_t capacity) { this->Items.assign(capacity + 1, T()); this->Head = 0; this->Tail = 0; }
+
+private:
+
+    std::vector<T>      Items;
+    std::atomic<size_t> Head;
+    std::atomic<size_t> Tail;
+
+    // threads sleeping in Push or Pop
+    std::atomic<size_t> Waiting;
+    std::mutex          Mutex;
+    std::condition_variable Condition;
+
+    bool                Put(const T& item)
+    {
+        size_t tail = this->Tail.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % this->Items.size();
+        if (next == this->Head.load(std::memory_order_acquire))
+            return false;
+
+        this->Items[tail] = item;
+        this->Tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool                Take(T& item)
+    {
+        size_t head = this->Head.load(std::memory_order_relaxed);
+        if (head == this->Tail.load(std::memory_order_acquire))
+            return false;
+
+        item = this->Items[head];
+        this->Head.store((head + 1) % this->Items.size(), std::memory_order_release);
+        return true;
+    }
+
+    // the waiter announces itself before looking at the queue again, and
+    // the other side looks for waiters after changing it, so the fences
+    // make sure one of them sees the other
+    template<typename Ready>
+    void                Wait(Ready ready)
+    {
+        std::unique_lock<std::mutex> lock(this->Mutex);
+        this->Waiting++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        this->Condition.wait(lock, ready);
+        this->Waiting--;
+    }
+
+    void                Wake()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (this->Waiting.load(std::memory_order_relaxed) == 0)
+            return;
+
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        this->Condition.notify_all();
+    }
+};
+
+}
@@ -0,0 +1,311 @@
+#include "server.hh"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace vidthumb {
+
+// longest request line accepted
+static const size_t MaxRequestLength = 8192;
+
+// clients that stop talking don't hold a worker forever
+static const int    SocketTimeout    = 30;
+
+static bool SendAll(int socket, const void* pData, size_t size)
+{
+    const char* pBytes = (const char*)pData;
+    while (size > 0) {
+        ssize_t sent = send(socket, pBytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+
+        pBytes += sent;
+        size   -= sent;
+    }
+    return true;
+}
+
+static bool SendLine(int socket, const std::string& line)
+{
+    std::string text = line + "\n";
+    return SendAll(socket, text.data(), text.size());
+}
+
+// unread request bytes would turn the close into a reset, losing the answer
+static void CloseClient(int socket)
+{
+    char buffer[4096];
+    shutdown(socket, SHUT_WR);
+    while (recv(socket, buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+        ;
+    close(socket);
+}
+
+Server::Server(const OverviewOptions& options) :
+    Options                     { options },
+    ListenSocket                { -1 },
+    Stopping                    { false }
+{
+    // requests are logged one line each, the per frame progress would interleave
+    this->Options.verbose = false;
+}
+
+Server::~Server()
+{
+    if (this->ListenSocket >= 0)
+        close(this->ListenSocket);
+}
+
+bool Server::Listen(const char *pSocketName)
+{
+    struct sockaddr_un address;
+    if (strlen(pSocketName) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket name %s is too long.\n", pSocketName);
+        return false;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, pSocketName);
+
+    this->ListenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (this->ListenSocket < 0) {
+        fprintf(stderr, "Could not create socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    // a socket left behind by a server that was killed is in the way, one
+    // that still answers is not ours to take
+    struct stat socketStat;
+    if (stat(pSocketName, &socketStat) == 0 && S_ISSOCK(socketStat.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool alive = probe >= 0 && connect(probe, (struct sockaddr*)&address, sizeof(address)) == 0;
+        if (probe >= 0)
+            close(probe);
+
+        if (alive) {
+            fprintf(stderr, "Socket %s is in use.\n", pSocketName);
+            return false;
+        }
+        unlink(pSocketName);
+    }
+
+    if (bind(this->ListenSocket, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(this->ListenSocket, SOMAXCONN) != 0) {
+        fprintf(stderr, "Could not listen on %s: %s\n", pSocketName, strerror(errno));
+        return false;
+    }
+
+    this->SocketName = pSocketName;
+    return true;
+}
+
+bool Server::Run(size_t workerCount, size_t queueLength)
+{
+    if (this->ListenSocket < 0)
+        return false;
+
+    if (workerCount == 0)
+        workerCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+    queueLength = std::max<size_t>(queueLength, 1);
+
+    // the workers already keep the cores busy
+    if (workerCount > 1 && this->Options.threadCount == 0)
+        this->Options.threadCount = 1;
+    if (workerCount > 1 && this->Options.segmentCount == 0)
+        this->Options.segmentCount = 1;
+
+    std::vector<std::thread> workers;
+    for (size_t i=0; i<workerCount; i++)
+        workers.emplace_back(&Server::Work, this);
+
+    fprintf(stderr, "Listening on %s with %zu workers.\n", this->SocketName.c_str(), workerCount);
+
+    bool success = true;
+    while (!this->Stopping) {
+        int clientSocket = accept(this->ListenSocket, nullptr, nullptr);
+        if (clientSocket < 0) {
+            if (this->Stopping)
+                break;
+            if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE)
+                continue;
+
+            fprintf(stderr, "Could not accept connection: %s\n", strerror(errno));
+            success = false;
+            break;
+        }
+
+        struct timeval timeout = { SocketTimeout, 0 };
+        setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(clientSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        std::unique_lock<std::mutex> lock(this->QueueMutex);
+        if (this->Queue.size() >= queueLength) {
+            lock.unlock();
+            SendLine(clientSocket, "error busy");
+            CloseClient(clientSocket);
+            continue;
+        }
+
+        this->Queue.push_back(clientSocket);
+        lock.unlock();
+        this->QueueCondition.notify_one();
+    }
+
+    // the queued connections are still served
+    {
+        std::lock_guard<std::mutex> lock(this->QueueMutex);
+        this->Stopping = true;
+    }
+    this->QueueCondition.notify_all();
+
+    for (auto& thread : workers)
+        thread.join();
+
+    // the socket itself is closed with the server, Stop may still use it
+    unlink(this->SocketName.c_str());
+    return success;
+}
+
+void Server::Stop()
+{
+    // wakes up accept
+    this->Stopping = true;
+    if (this->ListenSocket >= 0)
+        shutdown(this->ListenSocket, SHUT_RDWR);
+}
+
+void Server::Work()
+{
+    for (;;) {
+        std::unique_lock<std::mutex> lock(this->QueueMutex);
+        this->QueueCondition.wait(lock, [this]() { return !this->Queue.empty() || this->Stopping; });
+        if (this->Queue.empty())
+            break;
+
+        int clientSocket = this->Queue.front();
+        this->Queue.pop_front();
+        lock.unlock();
+
+        this->Serve(clientSocket);
+        CloseClient(clientSocket);
+    }
+}
+
+void Server::Serve(int clientSocket)
+{
+    char   line[MaxRequestLength];
+    size_t length = 0;
+    for (;;) {
+        ssize_t received = recv(clientSocket, line + length, sizeof(line) - 1 - length, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return;
+
+        length += received;
+        if (memchr(line, '\n', length))
+            break;
+        if (length == sizeof(line) - 1) {
+            SendLine(clientSocket, "error request too long");
+            return;
+        }
+    }
+    line[length] = 0;
+    line[strcspn(line, "\r\n")] = 0;
+
+    std::string     inputName, outputName, error;
+    OverviewOptions options = this->Options;
+    if (!this->ParseRequest(line, inputName, outputName, options, error)) {
+        SendLine(clientSocket, "error " + error);
+        return;
+    }
+
+    bool success;
+    if (outputName == "-") {
+        // the image is collected first, so a failure can still be reported
+        char*  pData = nullptr;
+        size_t size  = 0;
+        FILE*  pOutput = open_memstream(&pData, &size);
+        success = pOutput && CreateOverview(inputName.c_str(), pOutput, options);
+        if (pOutput)
+            success = fclose(pOutput) == 0 && success;
+
+        if (success)
+            success = SendLine(clientSocket, "ok " + std::to_string(size)) && SendAll(clientSocket, pData, size);
+        else
+            SendLine(clientSocket, "error could not create overview");
+        free(pData);
+    } else {
+        success = CreateOverview(inputName.c_str(), outputName.c_str(), options);
+        SendLine(clientSocket, success ? "ok" : "error could not create overview");
+    }
+
+    fprintf(stderr, "%s: %s\n", success ? "done" : "failed", inputName.c_str());
+}
+
+bool Server::ParseRequest(char *pLine, std::string& inputName, std::string& outputName, OverviewOptions& options, std::string& error)
+{
+    std::vector<char*> fields;
+    for (char* pField = pLine; pField; ) {
+        fields.push_back(pField);
+        pField = strchr(pField, '\t');
+        if (pField)
+            *pField++ = 0;
+    }
+
+    if (fields.size() < 2 || !fields[0][0] || !fields[1][0]) {
+        error = "expected input and output";
+        return false;
+    }
+    inputName  = fields[0];
+    outputName = fields[1];
+
+    for (size_t i=2; i<fields.size(); i++) {
+        char* pValue = strchr(fields[i], '=');
+        if (!pValue) {
+            error = std::string("expected name=value instead of ") + fields[i];
+            return false;
+        }
+        *pValue++ = 0;
+
+        const char* pName = fields[i];
+        bool valid = true;
+        if (!strcmp(pName, "grid")) {
+            valid = sscanf(pValue, "%zux%zu", &options.columns, &options.rows) == 2 && options.columns && options.rows;
+        } else if (!strcmp(pName, "thumb")) {
+            valid = sscanf(pValue, "%zux%zu", &options.thumbWidth, &options.thumbHeight) == 2 && options.thumbWidth && options.thumbHeight;
+        } else if (!strcmp(pName, "format")) {
+            options.output.format = pValue;
+        } else if (!strcmp(pName, "quality")) {
+            options.output.quality = atoi(pValue);
+        } else if (!strcmp(pName, "level")) {
+            options.output.compressionLevel = atoi(pValue);
+        } else {
+            error = std::string("unknown setting ") + pName;
+            return false;
+        }
+
+        if (!valid) {
+            error = std::string("invalid ") + pName + " " + pValue;
+            return false;
+        }
+    }
+
+    // the same limits as on the command line
+    return CheckOverviewOptions(options, error);
+}
+
+}
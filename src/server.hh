@@ -0,0 +1,66 @@
+#pragma once
+
+#include "overview.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+
+namespace vidthumb
+{
+
+// Creates overviews for the clients of a Unix domain socket, so they don't
+// pay for starting a process and setting up ffmpeg for every input. Each
+// request still opens its own demuxer, decoder and scalers.
+//
+// A client sends one request per connection, a line of tab separated fields:
+//
+//   input<TAB>output[<TAB>name=value...]
+//
+// with an output of - to have the overview sent back instead of written to
+// a file. Known settings are grid=CxR, thumb=WxH, format, quality and level.
+// The answer is "ok" for files, "ok <size>" followed by that many bytes of
+// image for -, or "error <reason>", each on a line of its own.
+class Server
+{
+public:
+
+                        Server(const OverviewOptions& options);
+                        ~Server();
+
+                        Server(const Server&) = delete;
+    Server&             operator=(const Server&) = delete;
+
+    // create the socket, replacing a stale one of the same name
+    bool                Listen(const char *pSocketName);
+
+    // serve until stopped, with the given number of workers, 0 for one per
+    // core, and at most queueLength connections waiting for them
+    bool                Run(size_t workerCount, size_t queueLength);
+
+    // make Run return once the queued requests are done, safe to call from
+    // a signal handler
+    void                Stop();
+
+private:
+
+    OverviewOptions     Options;
+
+    std::string         SocketName;
+    int                 ListenSocket;
+    std::atomic<bool>   Stopping;
+
+    // accepted connections waiting for a worker
+    std::deque<int>     Queue;
+    std::mutex          QueueMutex;
+    std::condition_variable QueueCondition;
+
+    void                Work();
+    void                Serve(int clientSocket);
+    bool                ParseRequest(char *pLine, std::string& inputName, std::string& outputName, OverviewOptions& options, std::string& error);
+};
+
+}
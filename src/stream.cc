@@ -2,35 +2,85 @@
 #include "ffmpeg_stream.hh"
 #include "zip_stream.hh"
 
+#include <algorithm>
+
 namespace vidthumb {
 
+StreamInput StreamInput::FromFile(const char *pFileName)
+{
+    StreamInput input;
+    input.fileName = pFileName;
+    return input;
+}
+
+StreamInput StreamInput::FromMemory(const uint8_t* pData, size_t size)
+{
+    StreamInput input;
+    input.pData = pData;
+    input.size  = size;
+    return input;
+}
+
+StreamInput StreamInput::FromCallbacks(ReadFunction read, SeekFunction seek, size_t size)
+{
+    StreamInput input;
+    input.read = read;
+    input.seek = seek;
+    input.size = size;
+    return input;
+}
+
+std::string StreamInput::GetName() const
+{
+    if (this->IsFile())
+        return this->fileName;
+    return this->pData ? "memory input" : "input";
+}
+
 Stream* 
-Stream::Open(const char *pFileName, size_t targetWidth, size_t targetHeight)
+Stream::Open(const char *pFileName, size_t targetWidth, size_t targetHeight, size_t threadCount)
+{
+    return Stream::Open(StreamInput::FromFile(pFileName), targetWidth, targetHeight, threadCount);
+}
+
+Stream* 
+Stream::Open(const StreamInput& input, size_t targetWidth, size_t targetHeight, size_t threadCount)
 {
     Stream* pStream;
 
     // try zip first
     pStream = new ZipStream(targetWidth, targetHeight);
-    if (pStream->Open(pFileName))
-        return pStream;
-    delete pStream;
+    pStream->ThreadCount = threadCount;
+    pStream->Input = input;
+    if (!pStream->Open(input)) {
+        delete pStream;
 
-    // try ffmpeg next
-    pStream = new FFMpegStream(targetWidth, targetHeight);
-    if (pStream->Open(pFileName))
-        return pStream;
-    delete pStream;
+        // try ffmpeg next
+        pStream = new FFMpegStream(targetWidth, targetHeight);
+        pStream->ThreadCount = threadCount;
+        pStream->Input = input;
+        if (!pStream->Open(input)) {
+            delete pStream;
+            return nullptr;
+        }
+    }
 
-    return nullptr;
+    return pStream;
 }
 
 Stream::Stream(size_t targetWidth, size_t targetHeight) :
+    RequestedWidth              { targetWidth },
+    RequestedHeight             { targetHeight },
+    ThreadCount                 { 0 },
     TargetWidth                 { targetWidth },
     TargetHeight                { targetHeight },
-    pFrameData                  { nullptr },
-    pTargetFrameData            { nullptr },
+    AnalysisWidth               { 64 },
+    AnalysisHeight              { 36 },
     frameNum                    { 0 },
-    totalFrameCount             { 0 }
+    totalFrameCount             { 0 },
+    duration                    { 0.0 },
+    frameTime                   { 0.0 },
+    DecodedFrameCount           { 0 }
 {
 }
 
@@ -38,4 +88,43 @@ Stream::~Stream()
 {
 }
 
+Stream* Stream::Clone() const
+{
+    return this->Clone(this->ThreadCount);
+}
+
+Stream* Stream::Clone(size_t threadCount) const
+{
+    // callbacks have only the one read position
+    if (this->Input.read)
+        return nullptr;
+
+    Stream* pStream = Stream::Open(this->Input, this->RequestedWidth, this->RequestedHeight, threadCount);
+    if (pStream) {
+        pStream->AnalysisWidth  = this->AnalysisWidth;
+        pStream->AnalysisHeight = this->AnalysisHeight;
+        pStream->frameIndex     = this->frameIndex;
+    }
+    return pStream;
+}
+
+void Stream::GetAnalysisSize(size_t width, size_t height, size_t& analysisWidth, size_t& analysisHeight) const
+{
+    float scale = std::min( (float)this->AnalysisWidth / width, (float)this->AnalysisHeight / height );
+    analysisWidth  = std::max<size_t>(width*scale, 1);
+    analysisHeight = std::max<size_t>(height*scale, 1);
+}
+
+bool Stream::SeekToFrame(size_t n)
+{
+    if (n < this->frameNum)
+        this->Rewind();
+
+    while (this->frameNum < n) {
+        if (!this->SkipNextFrame())
+            return false;
+    }
+    return true;
+}
+
 }
@@ -1,45 +1,151 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
 
 namespace vidthumb 
 {
 
 class Frame;
 
+struct FrameIndexEntry
+{
+    int64_t             timeStamp;      // in stream time base units
+    bool                isKeyFrame;
+};
+
+// Where the data of an input comes from: a file, a block of memory the caller
+// keeps valid while it is read, or callbacks reading it from anywhere else.
+struct StreamInput
+{
+    // fill up to size bytes from the current position, returning how many
+    // were read, 0 at the end and -1 on errors
+    typedef std::function<int64_t(uint8_t* pBuffer, size_t size)> ReadFunction;
+
+    // move to an absolute position, false if that is not possible
+    typedef std::function<bool(uint64_t position)> SeekFunction;
+
+    std::string         fileName;
+
+    const uint8_t*      pData       = nullptr;
+
+    // size of the memory block, or of the callbacks' data if known, 0 if not
+    size_t              size        = 0;
+
+    ReadFunction        read;
+    SeekFunction        seek;
+
+    static StreamInput  FromFile(const char *pFileName);
+    static StreamInput  FromMemory(const uint8_t* pData, size_t size);
+
+    // without a seek function the input can only be read once, from start to end
+    static StreamInput  FromCallbacks(ReadFunction read, SeekFunction seek, size_t size = 0);
+
+    bool                IsFile() const { return !this->pData && !this->read; }
+    bool                IsSeekable() const { return !this->read || this->seek; }
+
+    // the file name, or what the input is for messages
+    std::string         GetName() const;
+};
+
 class Stream
 {
 public:
 
-    static Stream*      Open(const char *pFileName, size_t targetWidth, size_t targetHeight);
+    // a thread count of 0 lets the decoder pick one thread per core
+    static Stream*      Open(const char *pFileName, size_t targetWidth, size_t targetHeight, size_t threadCount = 0);
+    static Stream*      Open(const StreamInput& input, size_t targetWidth, size_t targetHeight, size_t threadCount = 0);
 
     virtual             ~Stream();
 
+    // open another instance of the same input, sharing the frame index;
+    // not possible for inputs read through callbacks
+    Stream*             Clone() const;
+    Stream*             Clone(size_t threadCount) const;
+
+    // low quality frames are small gray frames of the analysis size, high
+    // quality frames are RGB at the target size
     virtual bool        GetNextFrame(Frame& frame, bool highQuality = false) = 0;
+    virtual bool        GetCurrentFrame(Frame& frame, bool highQuality = false) = 0;
     virtual bool        SkipNextFrame() = 0;
     virtual void        Rewind() = 0;
 
+    // position the stream so that the next GetNextFrame returns frame n
+    virtual bool        SeekToFrame(size_t n);
+
+    // position the stream so that the next GetNextFrame returns the first frame
+    // at or after the given time, if supported; frame numbers are estimates
+    // afterwards and the frame index is dropped
+    virtual bool        SeekToTime(double time) { (void)time; return false; }
+
+    // decode up to depth frames ahead on a separate thread, if supported
+    virtual void        SetDecodeAhead(size_t depth) { (void)depth; }
+
+    // number of parts, at most maxCount, that the input can be split into and
+    // decoded independently; after SetSegment the stream only returns the
+    // frames of that part, counted from 0 and indexed locally
+    virtual size_t      GetSegmentCount(size_t maxCount) const { (void)maxCount; return 1; }
+    virtual bool        SetSegment(size_t segment, size_t segmentCount) { return segment == 0 && segmentCount == 1; }
+
+    // only return frames that can be decoded on their own, if supported
+    virtual void        SetKeyFramesOnly(bool keyFramesOnly) { (void)keyFramesOnly; }
+
+    // box the low quality frames are fitted into, 64x36 by default
+    void                SetAnalysisSize(size_t width, size_t height) { this->AnalysisWidth = width; this->AnalysisHeight = height; }
+
     size_t              GetTargetWidth() const { return this->TargetWidth; }
     size_t              GetTargetHeight() const { return this->TargetHeight; }
 
     size_t              GetFrameNum() const { return this->frameNum; }
     size_t              GetTotalFrameCount() const { return this->totalFrameCount; }
 
+    // length of the input in seconds, 0 if unknown
+    double              GetDuration() const { return this->duration; }
+
+    // presentation time of the last returned frame in seconds
+    double              GetFrameTime() const { return this->frameTime; }
+
+    // frames the decoder produced, including those passed over, decoded
+    // ahead or decoded again after a seek
+    size_t              GetDecodedFrameCount() const { return this->DecodedFrameCount; }
+
+    // time stamps of all frames read so far, in order
+    const std::vector<FrameIndexEntry>& GetFrameIndex() const { return this->frameIndex; }
+    void                SetFrameIndex(const std::vector<FrameIndexEntry>& index) { this->frameIndex = index; }
+
 protected:
 
                         Stream(size_t targetWidth, size_t targetHeight);
 
-    virtual bool        Open(const char *pFileName) = 0;
+    virtual bool        Open(const StreamInput& input) = 0;
+
+    // fit an image of the given size into the analysis box, keeping its aspect
+    void                GetAnalysisSize(size_t width, size_t height, size_t& analysisWidth, size_t& analysisHeight) const;
+
+    StreamInput         Input;
+    size_t              RequestedWidth;
+    size_t              RequestedHeight;
+    size_t              ThreadCount;
 
     size_t              TargetWidth;
     size_t              TargetHeight;
 
-    uint8_t*            pFrameData;
-    uint8_t*            pTargetFrameData;
+    size_t              AnalysisWidth;
+    size_t              AnalysisHeight;
 
     size_t              frameNum;
     size_t              totalFrameCount;
+    double              duration;
+    double              frameTime;
+
+    std::vector<FrameIndexEntry> frameIndex;
+
+    // counted on whatever thread decodes, in const methods too
+    mutable std::atomic<size_t> DecodedFrameCount;
 };
 
 }
@@ -4,13 +4,16 @@
 #include <cstring>
 #include <zlib.h>
 
-#include <IL/il.h>
-#include <IL/ilu.h>
-
 #include <algorithm>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace vidthumb {
 
+// all records are little endian, like the machines this runs on
 struct ZipLocalHeader {
   uint8_t  magic[4];
   uint16_t version;
@@ -25,19 +28,75 @@ struct ZipLocalHeader {
   uint16_t extraLength;
 } __attribute__ ((packed));
 
+struct ZipCentralHeader {
+  uint8_t  magic[4];
+  uint16_t versionMadeBy;
+  uint16_t version;
+  uint16_t flags;
+  uint16_t method;
+  uint16_t time;
+  uint16_t date;
+  uint32_t crc32;
+  uint32_t compressedSize;
+  uint32_t uncompressedSize;
+  uint16_t nameLength;
+  uint16_t extraLength;
+  uint16_t commentLength;
+  uint16_t diskStart;
+  uint16_t internalAttributes;
+  uint32_t externalAttributes;
+  uint32_t localHeaderOffset;
+} __attribute__ ((packed));
+
+struct ZipEndOfCentralDirectory {
+  uint8_t  magic[4];
+  uint16_t diskNumber;
+  uint16_t centralDirectoryDisk;
+  uint16_t diskEntryCount;
+  uint16_t entryCount;
+  uint32_t centralDirectorySize;
+  uint32_t centralDirectoryOffset;
+  uint16_t commentLength;
+} __attribute__ ((packed));
+
+struct Zip64EndOfCentralDirectoryLocator {
+  uint8_t  magic[4];
+  uint32_t centralDirectoryDisk;
+  uint64_t endOfCentralDirectoryOffset;
+  uint32_t diskCount;
+} __attribute__ ((packed));
+
+struct Zip64EndOfCentralDirectory {
+  uint8_t  magic[4];
+  uint64_t recordSize;
+  uint16_t versionMadeBy;
+  uint16_t version;
+  uint32_t diskNumber;
+  uint32_t centralDirectoryDisk;
+  uint64_t diskEntryCount;
+  uint64_t entryCount;
+  uint64_t centralDirectorySize;
+  uint64_t centralDirectoryOffset;
+} __attribute__ ((packed));
+
+// the end record is followed by a comment of at most 64k
+static const size_t MaxEndOfCentralDirectorySearch = sizeof(ZipEndOfCentralDirectory) + 0xffff;
+
+static const uint16_t Zip64ExtraFieldId = 0x0001;
+
 ZipStream::ZipStream(size_t targetWidth, size_t targetHeight) :
     Stream                      { targetWidth, targetHeight },
-    pFile                       { nullptr },
-    hasValidSize                { nullptr }
+    pArchive                    { nullptr },
+    ArchiveSize                 { 0 },
+    ArchiveMapped               { false },
+    NextEntry                   { 0 },
+    CurrentEntry                { 0 },
+    pCurrentImage               { nullptr },
+    CurrentImageSize            { 0 },
+    DecodeAheadDepth            { 0 },
+    NextDecodeEntry             { 0 },
+    StopDecoding                { false }
 {
-    static bool isInited = false;
-
-    if (!isInited) {
-        ilInit();
-        iluInit();
-        isInited = true;
-    }
-
 }
 
 ZipStream::~ZipStream()
@@ -45,178 +104,532 @@ ZipStream::~ZipStream()
     this->Close();
 }
 
-bool ZipStream::Open(const char *pFileName)
+bool ZipStream::Open(const StreamInput& input)
 {
     this->Close();
 
-    this->pFile = fopen(pFileName, "rb");
-    if (!pFile)
+    if (input.IsFile()) {
+        if (!this->MapFile(input.fileName.c_str()))
+            return false;
+    } else if (input.pData) {
+        this->pArchive    = input.pData;
+        this->ArchiveSize = input.size;
+    } else if (!this->ReadInput(input)) {
         return false;
+    }
 
-    ZipLocalHeader header;
-    if (!fread(&header, sizeof(header), 1, this->pFile)) {
+    if (this->ArchiveSize < 4 || ::memcmp(this->pArchive, "PK\x03\x04", 4)) {
         this->Close();
         return false;
     }
 
-    if (::memcmp(header.magic, "PK\x03\x04", 4)) {
+    if (!this->ReadCentralDirectory()) {
+        fprintf(stderr, "Could not read zip central directory.\n");
         this->Close();
         return false;
     }
 
-    do {
-        this->totalFrameCount++;
+    this->totalFrameCount = this->Entries.size();
+    this->duration = this->Entries.size();
+    this->Rewind();
+    return true;
+}
 
-        fseek(this->pFile, header.nameLength, SEEK_CUR);
-        fseek(this->pFile, header.extraLength, SEEK_CUR);
-        fseek(this->pFile, header.compressedSize, SEEK_CUR);
-    } while(fread(&header, sizeof(header), 1, this->pFile));
+bool ZipStream::MapFile(const char *pFileName)
+{
+    int fd = open(pFileName, O_RDONLY);
+    if (fd < 0)
+        return false;
 
-    this->Rewind();
+    // only the pages of the entries actually read are ever touched
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size < 4) {
+        close(fd);
+        return false;
+    }
+
+    void* pMapping = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (pMapping == MAP_FAILED)
+        return false;
+
+    this->pArchive      = (const uint8_t*)pMapping;
+    this->ArchiveSize   = fileStat.st_size;
+    this->ArchiveMapped = true;
     return true;
 }
 
-void ZipStream::Close()
+bool ZipStream::ReadInput(const StreamInput& input)
 {
-    if (this->pFile) {
-        fclose(this->pFile);
-        this->pFile = nullptr;
+    // the entries are read in any order, so the archive is read into memory,
+    // but only once it looks like one; inputs that can't be sought back to
+    // the start are left to ffmpeg
+    if (!input.seek)
+        return false;
+
+    uint8_t magic[4];
+    if (input.read(magic, sizeof(magic)) != sizeof(magic) || ::memcmp(magic, "PK\x03\x04", 4)) {
+        input.seek(0);
+        return false;
+    }
+
+    this->ArchiveCopy.assign(magic, magic + sizeof(magic));
+    this->ArchiveCopy.reserve(std::max(input.size, this->ArchiveCopy.size()));
+
+    for (;;) {
+        size_t  offset = this->ArchiveCopy.size();
+        this->ArchiveCopy.resize(offset + std::max<size_t>(offset, 65536));
+
+        int64_t count  = input.read(this->ArchiveCopy.data() + offset, this->ArchiveCopy.size() - offset);
+        this->ArchiveCopy.resize(offset + std::max<int64_t>(count, 0));
+        if (count <= 0) {
+            if (count < 0) {
+                this->ArchiveCopy = std::vector<uint8_t>();
+                return false;
+            }
+            break;
+        }
+    }
+
+    this->pArchive    = this->ArchiveCopy.data();
+    this->ArchiveSize = this->ArchiveCopy.size();
+    return true;
+}
+
+bool ZipStream::ReadCentralDirectory()
+{
+    // find the end record, searching backwards over a possible comment
+    if (this->ArchiveSize < sizeof(ZipEndOfCentralDirectory))
+        return false;
+
+    size_t         tailSize = std::min(this->ArchiveSize, MaxEndOfCentralDirectorySearch);
+    const uint8_t* pTail    = this->pArchive + this->ArchiveSize - tailSize;
+
+    size_t endOffset = tailSize - sizeof(ZipEndOfCentralDirectory);
+    while (::memcmp(pTail + endOffset, "PK\x05\x06", 4)) {
+        if (endOffset == 0)
+            return false;
+        endOffset--;
+    }
+
+    ZipEndOfCentralDirectory end;
+    ::memcpy(&end, pTail + endOffset, sizeof(end));
+
+    uint64_t entryCount             = end.entryCount;
+    uint64_t centralDirectorySize   = end.centralDirectorySize;
+    uint64_t centralDirectoryOffset = end.centralDirectoryOffset;
+
+    // saturated fields mean the real values are in the zip64 end record
+    if (end.entryCount == 0xffff || end.centralDirectorySize == 0xffffffff || end.centralDirectoryOffset == 0xffffffff) {
+        Zip64EndOfCentralDirectoryLocator locator;
+        Zip64EndOfCentralDirectory end64;
+
+        if (endOffset < sizeof(locator))
+            return false;
+
+        ::memcpy(&locator, pTail + endOffset - sizeof(locator), sizeof(locator));
+        if (::memcmp(locator.magic, "PK\x06\x07", 4) || 
+            this->ArchiveSize < sizeof(end64) || locator.endOfCentralDirectoryOffset > this->ArchiveSize - sizeof(end64))
+            return false;
+
+        ::memcpy(&end64, this->pArchive + locator.endOfCentralDirectoryOffset, sizeof(end64));
+        if (::memcmp(end64.magic, "PK\x06\x06", 4))
+            return false;
+
+        entryCount             = end64.entryCount;
+        centralDirectorySize   = end64.centralDirectorySize;
+        centralDirectoryOffset = end64.centralDirectoryOffset;
+    }
+
+    if (centralDirectoryOffset > this->ArchiveSize || centralDirectorySize > this->ArchiveSize - centralDirectoryOffset)
+        return false;
+
+    // parsed straight from the mapping
+    const uint8_t* pDirectory    = this->pArchive + centralDirectoryOffset;
+    size_t         directorySize = centralDirectorySize;
+
+    // every entry takes at least a header, so a larger count is made up
+    if (entryCount > directorySize / sizeof(ZipCentralHeader))
+        return false;
+
+    this->Entries.clear();
+    this->Entries.reserve(entryCount);
+
+    size_t offset = 0;
+    for (uint64_t i=0; i<entryCount; i++) {
+        ZipCentralHeader header;
+        if (offset + sizeof(header) > directorySize)
+            return false;
+
+        ::memcpy(&header, pDirectory + offset, sizeof(header));
+        if (::memcmp(header.magic, "PK\x01\x02", 4))
+            return false;
+
+        const uint8_t* pName  = pDirectory + offset + sizeof(header);
+        const uint8_t* pExtra = pName + header.nameLength;
+        offset += sizeof(header) + header.nameLength + header.extraLength + header.commentLength;
+        if (offset > directorySize)
+            return false;
+
+        ZipEntry entry;
+        entry.name              = std::string((const char*)pName, header.nameLength);
+        entry.localHeaderOffset = header.localHeaderOffset;
+        entry.compressedSize    = header.compressedSize;
+        entry.uncompressedSize  = header.uncompressedSize;
+        entry.method            = header.method;
+
+        // the zip64 extra field holds only the values saturated above, in this order
+        for (const uint8_t* pField = pExtra; pField + 4 <= pExtra + header.extraLength; ) {
+            uint16_t id, size;
+            ::memcpy(&id,   pField,     2);
+            ::memcpy(&size, pField + 2, 2);
+
+            const uint8_t* pValue = pField + 4;
+            const uint8_t* pEnd   = std::min(pValue + size, pExtra + header.extraLength);
+            if (id == Zip64ExtraFieldId) {
+                uint64_t* values[3] = { &entry.uncompressedSize, &entry.compressedSize, &entry.localHeaderOffset };
+                for (uint64_t* pValueOut : values) {
+                    if (*pValueOut != 0xffffffff)
+                        continue;
+                    if (pValue + 8 > pEnd)
+                        break;
+                    ::memcpy(pValueOut, pValue, 8);
+                    pValue += 8;
+                }
+            }
+            pField += 4 + size;
+        }
+
+        // only images, so no directories, empty files or thumbnails of other tools
+        if (entry.uncompressedSize == 0 || entry.name.empty() || entry.name.back() == '/' || 
+            strstr(entry.name.c_str(), ".thumb") || (entry.method != 0 && entry.method != 8))
+            continue;
+
+        this->Entries.push_back(entry);
     }
+
+    return true;
+}
+
+void ZipStream::Close()
+{
+    this->StopDecodeAhead();
+
+    this->CurrentEntry = 0;
+    this->pCurrentImage = nullptr;
+    this->CurrentImageSize = 0;
+    this->Entries.clear();
+    this->NextEntry = 0;
+
+    if (this->ArchiveMapped)
+        munmap((void*)this->pArchive, this->ArchiveSize);
+    this->pArchive = nullptr;
+    this->ArchiveSize = 0;
+    this->ArchiveMapped = false;
+    this->ArchiveCopy = std::vector<uint8_t>();
 }
 
 bool ZipStream::IsOpen() const 
 {
-    return this->pFile != nullptr;
+    return this->pArchive != nullptr;
 }
 
 bool ZipStream::GetNextFrame(Frame& frame, bool highQuality)
 {
-    ZipLocalHeader header;
-    while(fread(&header, sizeof(header), 1, this->pFile)) {
-        char* name = (char*)alloca(header.nameLength+1);
+    if (!highQuality && this->DecodeAheadDepth)
+        return this->GetNextDecodedFrame(frame);
 
-        fread(name, header.nameLength, 1, this->pFile);
-        name[header.nameLength] = 0;
+    this->StopDecodeAhead();
 
-        //fseek(this->pFile, header.nameLength, SEEK_CUR);
-        fseek(this->pFile, header.extraLength, SEEK_CUR);
+    // entries that fail to decode are passed over, so the index maps frames to entries
+    while (this->NextEntry < this->Entries.size()) {
+        size_t entry = this->NextEntry++;
 
-        if (header.compressedSize == 0)
-            continue;
+        if (this->LoadImage(this->Entries[entry], this->inflatedImage, this->pCurrentImage) &&
+            this->DecodeImage(this->pCurrentImage, this->Entries[entry].uncompressedSize, this->Decoder, frame, highQuality)) {
+            if (this->frameNum == this->frameIndex.size())
+                this->frameIndex.push_back({ (int64_t)entry, true });
 
-        uint8_t* data = new uint8_t[header.compressedSize];
-        if (!fread(data, header.compressedSize, 1, this->pFile)) {
-            delete [] data;
-            return false;
+            this->CurrentEntry = entry;
+            this->CurrentImageSize = this->Entries[entry].uncompressedSize;
+            this->frameTime = this->frameNum++;
+            return true;
         }
+    }
+
+    this->pCurrentImage = nullptr;
+    return false;
+}
+
+bool ZipStream::GetNextDecodedFrame(Frame& frame)
+{
+    if (this->DecodeThreads.empty())
+        this->StartDecodeAhead();
+
+    std::unique_lock<std::mutex> lock(this->DecodeMutex);
+
+    // frames are handed out in archive order, whichever thread finished first
+    while (this->NextEntry < this->Entries.size()) {
+        size_t      entry = this->NextEntry;
+        DecodeSlot& slot  = this->DecodeSlots[entry % this->DecodeSlots.size()];
 
-        if (!strstr(name, ".thumb") && this->LoadFrame(frame, header, data, highQuality)) {
-            delete [] data;
+        this->DecodeCondition.wait(lock, [&]() { return slot.ready && slot.entry == entry; });
+
+        // the frame given back is reused by the worker for a later entry
+        std::swap(frame, slot.frame);
+        slot.ready = false;
+        this->NextEntry++;
+        this->DecodeCondition.notify_all();
+
+        if (slot.success) {
+            if (this->frameNum == this->frameIndex.size())
+                this->frameIndex.push_back({ (int64_t)entry, true });
+
+            this->CurrentEntry = entry;
+            this->pCurrentImage = nullptr;
+            this->frameTime = this->frameNum++;
             return true;
         }
-
-        delete [] data;
     }
 
+    this->pCurrentImage = nullptr;
     return false;
 }
 
-
 bool ZipStream::SkipNextFrame()
 {
-    ZipLocalHeader header;
-    if (!fread(&header, sizeof(header), 1, this->pFile)) {
+    this->StopDecodeAhead();
+    this->pCurrentImage = nullptr;
+
+    if (this->NextEntry >= this->Entries.size())
         return false;
-    }
-    
-    fseek(this->pFile, header.nameLength, SEEK_CUR);
-    fseek(this->pFile, header.extraLength, SEEK_CUR);
-    fseek(this->pFile, header.compressedSize, SEEK_CUR);
 
+    size_t entry = this->NextEntry++;
+    if (this->frameNum == this->frameIndex.size())
+        this->frameIndex.push_back({ (int64_t)entry, true });
+
+    this->CurrentEntry = entry;
+    this->frameTime = this->frameNum++;
     return true;
 }
 
 void ZipStream::Rewind()
 {
-    fseek(this->pFile, 0, SEEK_SET);
+    this->StopDecodeAhead();
+    this->NextEntry = 0;
     this->frameNum = 0;
+    this->pCurrentImage = nullptr;
 }
 
-bool ZipStream::LoadFrame(Frame& frame, const ZipLocalHeader& header, const void* data, bool highQuality)
+bool ZipStream::SeekToFrame(size_t n)
 {
-    uint8_t* pUncompressed = new uint8_t[header.uncompressedSize];
-    if (!this->Uncompress(header, data, pUncompressed)) {
-        delete [] pUncompressed;
+    // every entry can be read on its own
+    if (n < this->frameIndex.size()) {
+        this->StopDecodeAhead();
+        this->pCurrentImage = nullptr;
+        this->NextEntry = this->frameIndex[n].timeStamp;
+        this->frameNum  = n;
+        return true;
+    }
+
+    // continue after the last known frame
+    if (!this->frameIndex.empty() && n > this->frameNum) {
+        this->StopDecodeAhead();
+        this->pCurrentImage = nullptr;
+        this->NextEntry = this->frameIndex.back().timeStamp + 1;
+        this->frameNum  = this->frameIndex.size();
+    }
+
+    return Stream::SeekToFrame(n);
+}
+
+bool ZipStream::SeekToTime(double time)
+{
+    if (time < 0.0 || time >= this->Entries.size())
         return false;
+
+    this->StopDecodeAhead();
+    this->pCurrentImage = nullptr;
+    this->frameIndex.clear();
+    this->NextEntry = time;
+    this->frameNum  = this->NextEntry;
+    return true;
+}
+
+bool ZipStream::GetCurrentFrame(Frame& frame, bool highQuality)
+{
+    // nothing read since open or rewind
+    if (this->frameNum == 0)
+        return false;
+
+    const ZipEntry& entry = this->Entries[this->CurrentEntry];
+    if (!this->pCurrentImage) {
+        if (!this->LoadImage(entry, this->inflatedImage, this->pCurrentImage))
+            return false;
+        this->CurrentImageSize = entry.uncompressedSize;
     }
 
-    bool success = true;
-    ILuint image = ilGenImage();
-    ilBindImage(image);
+    return this->DecodeImage(this->pCurrentImage, this->CurrentImageSize, this->Decoder, frame, highQuality);
+}
+
+bool ZipStream::LoadImage(const ZipEntry& entry, std::vector<uint8_t>& inflateBuffer, const uint8_t*& pImage) const
+{
+    // the local header's name and extra field may differ from the central ones
+    ZipLocalHeader header;
+    if (this->ArchiveSize < sizeof(header) || entry.localHeaderOffset > this->ArchiveSize - sizeof(header))
+        return false;
+
+    ::memcpy(&header, this->pArchive + entry.localHeaderOffset, sizeof(header));
+    if (::memcmp(header.magic, "PK\x03\x04", 4))
+        return false;
 
-    if (!ilLoadL(IL_TYPE_UNKNOWN, pUncompressed, header.uncompressedSize)) {
-        success = false;
-    } else {
-            // rescale target size
-            ILuint width = ilGetInteger(IL_IMAGE_WIDTH);
-            ILuint height = ilGetInteger(IL_IMAGE_HEIGHT);
-            float scale = std::min( (float)this->TargetWidth / width, (float)this->TargetHeight / height );
-            width = width*scale;
-            height = height*scale;
+    uint64_t dataOffset = entry.localHeaderOffset + sizeof(header) + header.nameLength + header.extraLength;
+    if (dataOffset > this->ArchiveSize || entry.compressedSize > this->ArchiveSize - dataOffset)
+        return false;
 
-            ilConvertImage(IL_BGRA, IL_UNSIGNED_BYTE);
+    const uint8_t* pCompressed = this->pArchive + dataOffset;
 
-        iluImageParameter(ILU_FILTER, highQuality ? ILU_BILINEAR : ILU_NEAREST);
-        iluScale(width, height, 1);
+    if (entry.method == 0) {
+        // stored images are decoded straight from the mapping
+        if (entry.compressedSize != entry.uncompressedSize)
+            return false;
 
-        uint8_t* pPixels = new uint8_t[width*height*4];
-        ilCopyPixels(0,0,0, width, height, 1, IL_BGRA, IL_UNSIGNED_BYTE, pPixels);
-        frame = Frame(pPixels, width, height, width*4);
-        delete [] pPixels;
+        pImage = pCompressed;
+        return true;
     }
 
-    ilDeleteImage(image);
+    // the inflate buffer only ever grows
+    if (inflateBuffer.size() < entry.uncompressedSize)
+        inflateBuffer.resize(entry.uncompressedSize);
 
-    delete [] pUncompressed;
-    return success;
+    if (!this->Inflate(entry, pCompressed, inflateBuffer.data()))
+        return false;
+
+    pImage = inflateBuffer.data();
+    return true;
 }
 
-bool ZipStream::Uncompress(const ZipLocalHeader& header, const void* pCompressed, void* pUncompressed)
+bool ZipStream::DecodeImage(const uint8_t* pImage, size_t size, ImageDecoder& decoder, Frame& frame, bool highQuality) const
 {
-    switch(header.method) {
-        // store
-        case 0: {
-            ::memcpy(pUncompressed, pCompressed, header.uncompressedSize);
-            return true;
-        }
+    this->DecodedFrameCount++;
 
-         // deflate
-        case 8: {
-            int       result;
-            z_stream  stream;
-
-            stream.zalloc     = Z_NULL;
-            stream.zfree      = Z_NULL;
-            stream.opaque     = Z_NULL;
-            stream.avail_in   = 0;
-            stream.next_in    = Z_NULL;
-            stream.avail_out  = 0;
-            stream.next_out   = Z_NULL;
-
-            result = inflateInit2(&stream, -MAX_WBITS);
-            if (result != Z_OK) {
-                return false;
-            }
+    // low quality frames are only looked at as luminance at analysis size
+    if (highQuality)
+        return decoder.Decode(pImage, size, this->TargetWidth, this->TargetHeight, PixelFormat::RGB, true, frame);
+    else
+        return decoder.Decode(pImage, size, this->AnalysisWidth, this->AnalysisHeight, PixelFormat::Gray, false, frame);
+}
 
-            stream.avail_in   = header.compressedSize;
-            stream.next_in    = (Bytef*)pCompressed;
-            stream.avail_out  = header.uncompressedSize;
-            stream.next_out   = (Bytef*)pUncompressed;
+void ZipStream::SetDecodeAhead(size_t depth)
+{
+    this->StopDecodeAhead();
+    this->DecodeAheadDepth = depth;
+}
 
-            return inflate(&stream, Z_FINISH) == Z_STREAM_END;
-        }
+void ZipStream::StartDecodeAhead()
+{
+    size_t threadCount = this->ThreadCount ? this->ThreadCount : std::max<unsigned>(std::thread::hardware_concurrency(), 1);
+
+    // enough slots to keep every thread busy while the oldest is waited for
+    this->DecodeSlots.resize(std::max(this->DecodeAheadDepth, 2*threadCount));
+    for (DecodeSlot& slot : this->DecodeSlots)
+        slot.ready = false;
+
+    this->NextDecodeEntry = this->NextEntry;
+    this->StopDecoding = false;
+
+    for (size_t i=0; i<threadCount; i++)
+        this->DecodeThreads.emplace_back(&ZipStream::DecodeAhead, this);
+}
+
+void ZipStream::StopDecodeAhead()
+{
+    if (this->DecodeThreads.empty())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(this->DecodeMutex);
+        this->StopDecoding = true;
     }
-    return false;
+    this->DecodeCondition.notify_all();
+
+    for (std::thread& thread : this->DecodeThreads)
+        thread.join();
+    this->DecodeThreads.clear();
+}
+
+void ZipStream::DecodeAhead()
+{
+    // each thread has its own decoder and inflate buffer
+    ImageDecoder         decoder;
+    std::vector<uint8_t> inflateBuffer;
+    Frame                frame;
+
+    std::unique_lock<std::mutex> lock(this->DecodeMutex);
+    for (;;) {
+        // an entry may only be claimed once its slot has been consumed
+        this->DecodeCondition.wait(lock, [this]() { 
+            return this->StopDecoding || (this->NextDecodeEntry < this->Entries.size() && 
+                                          this->NextDecodeEntry < this->NextEntry + this->DecodeSlots.size());
+        });
+        if (this->StopDecoding)
+            break;
+
+        size_t entry = this->NextDecodeEntry++;
+        lock.unlock();
+
+        const uint8_t* pImage = nullptr;
+        bool success = this->LoadImage(this->Entries[entry], inflateBuffer, pImage) &&
+                       this->DecodeImage(pImage, this->Entries[entry].uncompressedSize, decoder, frame, false);
+
+        lock.lock();
+        DecodeSlot& slot = this->DecodeSlots[entry % this->DecodeSlots.size()];
+        std::swap(frame, slot.frame);
+        slot.entry   = entry;
+        slot.success = success;
+        slot.ready   = true;
+        this->DecodeCondition.notify_all();
+    }
+}
+
+bool ZipStream::Inflate(const ZipEntry& entry, const void* pCompressed, void* pUncompressed) const
+{
+    int       result;
+    z_stream  stream;
+
+    stream.zalloc     = Z_NULL;
+    stream.zfree      = Z_NULL;
+    stream.opaque     = Z_NULL;
+    stream.avail_in   = 0;
+    stream.next_in    = Z_NULL;
+    stream.avail_out  = 0;
+    stream.next_out   = Z_NULL;
+
+    result = inflateInit2(&stream, -MAX_WBITS);
+    if (result != Z_OK) {
+        return false;
+    }
+
+    // avail_in and avail_out are only 32 bits wide
+    uint64_t compressedLeft   = entry.compressedSize;
+    uint64_t uncompressedLeft = entry.uncompressedSize;
+    stream.next_in    = (Bytef*)pCompressed;
+    stream.next_out   = (Bytef*)pUncompressed;
+
+    do {
+        uInt inChunk  = std::min<uint64_t>(compressedLeft,   0x40000000);
+        uInt outChunk = std::min<uint64_t>(uncompressedLeft, 0x40000000);
+        stream.avail_in  = inChunk;
+        stream.avail_out = outChunk;
+
+        result = inflate(&stream, Z_NO_FLUSH);
+        compressedLeft   -= inChunk  - stream.avail_in;
+        uncompressedLeft -= outChunk - stream.avail_out;
+    } while (result == Z_OK && (stream.avail_in == 0 || stream.avail_out == 0) && (compressedLeft || uncompressedLeft));
+
+    bool success = result == Z_STREAM_END && uncompressedLeft == 0;
+    inflateEnd(&stream);
+    return success;
 }
 
 }
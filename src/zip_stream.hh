@@ -1,13 +1,27 @@
 #pragma once
 
 #include "stream.hh"
+#include "frame.hh"
+#include "image_decoder.hh"
 
-#include <cstdio>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace vidthumb 
 {
 
-struct ZipLocalHeader;
+// an image in the archive, as listed in the central directory
+struct ZipEntry
+{
+    std::string         name;
+    uint64_t            localHeaderOffset;
+    uint64_t            compressedSize;
+    uint64_t            uncompressedSize;
+    uint16_t            method;
+};
 
 class ZipStream : public Stream
 {
@@ -17,22 +31,74 @@ public:
     virtual             ~ZipStream();
 
     bool                GetNextFrame(Frame& frame, bool highQuality = false) override;
+    bool                GetCurrentFrame(Frame& frame, bool highQuality = false) override;
     bool                SkipNextFrame() override;
 
     void                Rewind() override;
+    bool                SeekToFrame(size_t n) override;
+
+    // every image counts as one second
+    bool                SeekToTime(double time) override;
+
+    // inflate and decode low quality frames on a pool of threads
+    void                SetDecodeAhead(size_t depth) override;
 
 protected:
 
+    // a low quality frame decoded ahead, for the entry with the same index
+    // modulo the number of slots
+    struct DecodeSlot
+    {
+        Frame           frame;
+        size_t          entry;
+        bool            ready;
+        bool            success;
+    };
 
-    FILE*               pFile;
-    bool 				hasValidSize;
+    // the whole archive, mapped read only for files, the caller's memory or
+    // a copy of what the callbacks read otherwise
+    const uint8_t*      pArchive;
+    size_t              ArchiveSize;
+    bool                ArchiveMapped;
+    std::vector<uint8_t> ArchiveCopy;
 
-    bool                Open(const char *pFileName) override;
+    // images in archive order, and the one the next frame is read from
+    std::vector<ZipEntry> Entries;
+    size_t              NextEntry;
+
+    // entry last returned by GetNextFrame and its image data, pointing into
+    // the archive for stored entries and into the inflate buffer for deflated
+    // ones; the data is loaded again if the frame came from the pool
+    size_t              CurrentEntry;
+    const uint8_t*      pCurrentImage;
+    size_t              CurrentImageSize;
+    std::vector<uint8_t> inflatedImage;
+    ImageDecoder        Decoder;
+
+    // decode ahead pool, started by the first low quality read
+    size_t              DecodeAheadDepth;
+    std::vector<DecodeSlot> DecodeSlots;
+    std::vector<std::thread> DecodeThreads;
+    std::mutex          DecodeMutex;
+    std::condition_variable DecodeCondition;
+    size_t              NextDecodeEntry;
+    bool                StopDecoding;
+
+    bool                Open(const StreamInput& input) override;
+    bool                MapFile(const char *pFileName);
+    bool                ReadInput(const StreamInput& input);
     void                Close();
     bool                IsOpen() const;
 
-    bool 				LoadFrame(Frame& frame, const ZipLocalHeader& header, const void* data, bool highQuality);
-    bool 				Uncompress(const ZipLocalHeader& header, const void* pCompressed, void* pUncompressed);
+    bool                ReadCentralDirectory();
+    bool                LoadImage(const ZipEntry& entry, std::vector<uint8_t>& inflateBuffer, const uint8_t*& pImage) const;
+    bool                DecodeImage(const uint8_t* pImage, size_t size, ImageDecoder& decoder, Frame& frame, bool highQuality) const;
+    bool                Inflate(const ZipEntry& entry, const void* pCompressed, void* pUncompressed) const;
+
+    bool                GetNextDecodedFrame(Frame& frame);
+    void                DecodeAhead();
+    void                StartDecodeAhead();
+    void                StopDecodeAhead();
 };
 
 }
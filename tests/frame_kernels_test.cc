@@ -0,0 +1,99 @@
+// Checks every frame kernel this CPU can run against the scalar version, on
+// random rows of all lengths up to a few vectors and at unaligned starts, and
+// on rows long enough for the vector sums to be flushed several times.
+
+#include "frame_kernels.hh"
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace vidthumb;
+
+// long enough for a full AVX-512 vector of 32 bit pixels plus every remainder
+static const size_t MaxPixels = 130;
+static const size_t MaxOffset = 64;
+
+// the kernels flush their 32 bit lanes every 4096 vectors, which is 16 to 32
+// pixels per vector depending on the kernel, odd lengths leave a remainder
+static const size_t LongPixels[] = { 4096 * 16 - 1, 4096 * 16 + 1, 4096 * 32 * 2 + 3, 4096 * 32 * 3 + 31 };
+static const size_t LongOffsets[] = { 0, 1, 3, 17 };
+
+// all four kernels on the rows against the scalar ones, gray rows have up to
+// four times the pixels in the same bytes
+static size_t Check(const char* pName, const uint8_t* pRow1, const uint8_t* pRow2, size_t pixels, size_t offset)
+{
+    size_t failures = 0;
+
+    // the sums are added to
+    uint64_t sum = 0, sumSquares = 0, expectedSum = 0, expectedSumSquares = 0;
+
+    if (SumSquaredDifferences(pRow1, pRow2, pixels) != SumSquaredDifferencesScalar(pRow1, pRow2, pixels)) {
+        fprintf(stderr, "%s: SumSquaredDifferences differs for %zu pixels at offset %zu\n", pName, pixels, offset);
+        failures++;
+    }
+
+    SumLuma(pRow1, pixels, sum, sumSquares);
+    SumLumaScalar(pRow1, pixels, expectedSum, expectedSumSquares);
+    if (sum != expectedSum || sumSquares != expectedSumSquares) {
+        fprintf(stderr, "%s: SumLuma differs for %zu pixels at offset %zu\n", pName, pixels, offset);
+        failures++;
+    }
+
+    for (size_t grayPixels : { pixels, pixels * 4 }) {
+        sum = sumSquares = expectedSum = expectedSumSquares = 0;
+
+        if (SumSquaredDifferencesGray(pRow1, pRow2, grayPixels) != SumSquaredDifferencesGrayScalar(pRow1, pRow2, grayPixels)) {
+            fprintf(stderr, "%s: SumSquaredDifferencesGray differs for %zu pixels at offset %zu\n", pName, grayPixels, offset);
+            failures++;
+        }
+
+        SumGray(pRow1, grayPixels, sum, sumSquares);
+        SumGrayScalar(pRow1, grayPixels, expectedSum, expectedSumSquares);
+        if (sum != expectedSum || sumSquares != expectedSumSquares) {
+            fprintf(stderr, "%s: SumGray differs for %zu pixels at offset %zu\n", pName, grayPixels, offset);
+            failures++;
+        }
+    }
+
+    return failures;
+}
+
+int main()
+{
+    std::minstd_rand random(1);
+    std::vector<uint8_t> row1((MaxPixels + MaxOffset) * 4), row2(row1.size());
+    std::vector<uint8_t> longRow1((LongPixels[3] + MaxOffset) * 4), longRow2(longRow1.size());
+
+    size_t failures = 0;
+    for (const char* pName : GetKernelNames()) {
+        SetKernels(pName);
+
+        for (int fill=0; fill<3; fill++) {
+            // random bytes, then all 255 for the largest sums, then all 0
+            for (size_t i=0; i<row1.size(); i++) {
+                row1[i] = fill == 0 ? random() : fill == 1 ? 255 : 0;
+                row2[i] = fill == 0 ? random() : 0;
+            }
+
+            for (size_t pixels=0; pixels<=MaxPixels; pixels++) {
+                for (size_t offset=0; offset<MaxOffset; offset += offset < 8 ? 1 : 7)
+                    failures += Check(pName, row1.data() + offset, row2.data() + (offset * 3) % MaxOffset, pixels, offset);
+            }
+
+            for (size_t i=0; i<longRow1.size(); i++) {
+                longRow1[i] = fill == 0 ? random() : fill == 1 ? 255 : 0;
+                longRow2[i] = fill == 0 ? random() : 0;
+            }
+
+            for (size_t pixels : LongPixels) {
+                for (size_t offset : LongOffsets)
+                    failures += Check(pName, longRow1.data() + offset, longRow2.data() + (offset * 3) % MaxOffset, pixels, offset);
+            }
+        }
+
+        printf("%s: checked\n", pName);
+    }
+
+    return failures == 0 ? 0 : 1;
+}
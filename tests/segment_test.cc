@@ -0,0 +1,275 @@
+// Checks that a video with B-frames analysed in key frame aligned segments
+// gives the same frames, time stamps, differences and contrasts as one pass
+// over the whole of it, and that seeks in key frame only mode land on the
+// key frames one pass over them returns.
+//
+//   segment_test [clip.mp4]
+//
+// The clip is written first, to the given name or segment_test.mp4.
+
+#include "frame.hh"
+#include "stream.hh"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace vidthumb;
+
+namespace {
+
+static const int    FrameRate   = 25;
+static const size_t FrameCount  = 300;
+static const size_t SceneLength = 40;
+static const int    Width       = 320;
+static const int    Height      = 240;
+
+struct Analysis
+{
+    std::vector<double> frameTimes;
+    std::vector<float>  frameDiffs;
+    std::vector<float>  frameContrasts;
+};
+
+// moving stripes and a moving block, with a cut every few seconds
+void FillYUV(AVFrame* pFrame, size_t index)
+{
+    size_t scene = index / SceneLength;
+    size_t t     = index % SceneLength;
+
+    for (int y=0; y<pFrame->height; y++) {
+        for (int x=0; x<pFrame->width; x++) {
+            bool block = x >= (int)(t * 6) && x < (int)(t * 6 + 48) && y >= 96 && y < 144;
+            pFrame->data[0][y * pFrame->linesize[0] + x] = block ? 235 : (((x + scene * 29) * (1 + scene % 3) + y + t * 3) & 0x7f) + 32;
+        }
+    }
+
+    for (int plane=1; plane<3; plane++) {
+        for (int y=0; y<pFrame->height / 2; y++) {
+            for (int x=0; x<pFrame->width / 2; x++)
+                pFrame->data[plane][y * pFrame->linesize[plane] + x] = 128 + ((scene * 37 * plane + x) & 0x1f);
+        }
+    }
+}
+
+bool EncodeFrame(AVFormatContext* pFormat, AVStream* pStream, AVCodecContext* pContext, AVFrame* pFrame, AVPacket* pPacket)
+{
+    if (avcodec_send_frame(pContext, pFrame) < 0)
+        return false;
+
+    for (;;) {
+        int result = avcodec_receive_packet(pContext, pPacket);
+        if (result == AVERROR(EAGAIN) || result == AVERROR_EOF)
+            return true;
+        if (result < 0)
+            return false;
+
+        av_packet_rescale_ts(pPacket, pContext->time_base, pStream->time_base);
+        pPacket->stream_index = pStream->index;
+        if (av_interleaved_write_frame(pFormat, pPacket) < 0)
+            return false;
+    }
+}
+
+// MPEG-4 part 2 in mp4, whose index has decode time stamps, with two B-frames
+// between the others so presentation time stamps run ahead of them
+bool WriteClip(AVCodec* pCodec, const std::string& fileName)
+{
+    AVFormatContext* pFormat  = nullptr;
+    AVCodecContext*  pContext = nullptr;
+    AVFrame*         pFrame   = av_frame_alloc();
+    AVPacket*        pPacket  = av_packet_alloc();
+    AVStream*        pStream  = nullptr;
+    bool             success  = false;
+
+    if (avformat_alloc_output_context2(&pFormat, nullptr, nullptr, fileName.c_str()) >= 0 && pFrame && pPacket) {
+        pStream  = avformat_new_stream(pFormat, nullptr);
+        pContext = avcodec_alloc_context3(pCodec);
+    }
+
+    if (pStream && pContext) {
+        pContext->width         = Width;
+        pContext->height        = Height;
+        pContext->pix_fmt       = AV_PIX_FMT_YUV420P;
+        pContext->time_base     = AVRational { 1, FrameRate };
+        pContext->framerate     = AVRational { FrameRate, 1 };
+        pContext->gop_size      = 12;
+        pContext->max_b_frames  = 2;
+        pContext->bit_rate      = Width * Height * FrameRate / 4;
+
+        if (pFormat->oformat->flags & AVFMT_GLOBALHEADER)
+            pContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+        pFrame->format = pContext->pix_fmt;
+        pFrame->width  = Width;
+        pFrame->height = Height;
+
+        success = avcodec_open2(pContext, pCodec, nullptr) == 0
+            && avcodec_parameters_from_context(pStream->codecpar, pContext) >= 0
+            && av_frame_get_buffer(pFrame, 32) == 0
+            && avio_open(&pFormat->pb, fileName.c_str(), AVIO_FLAG_WRITE) >= 0;
+    }
+
+    if (success) {
+        pStream->time_base = pContext->time_base;
+        success = avformat_write_header(pFormat, nullptr) >= 0;
+
+        for (size_t i=0; i<FrameCount && success; i++) {
+            success = av_frame_make_writable(pFrame) == 0;
+            FillYUV(pFrame, i);
+            pFrame->pts = i;
+            success = success && EncodeFrame(pFormat, pStream, pContext, pFrame, pPacket);
+        }
+
+        success = success && EncodeFrame(pFormat, pStream, pContext, nullptr, pPacket);
+        success = av_write_trailer(pFormat) == 0 && success;
+    }
+
+    if (pFormat && pFormat->pb)
+        avio_closep(&pFormat->pb);
+    if (pFormat)
+        avformat_free_context(pFormat);
+    avcodec_free_context(&pContext);
+    av_packet_free(&pPacket);
+    av_frame_free(&pFrame);
+    return success;
+}
+
+// the segments one after the other, differences taken across their bounds
+// like CreateOverview does when it merges them
+bool Analyze(const Stream* pStream, size_t segmentCount, Analysis& analysis)
+{
+    Frame frames[2];
+    Frame* pCurFrame  = frames + 0;
+    Frame* pLastFrame = frames + 1;
+
+    for (size_t i=0; i<segmentCount; i++) {
+        Stream* pSegmentStream = pStream->Clone(1);
+        if (!pSegmentStream || !pSegmentStream->SetSegment(i, segmentCount)) {
+            delete pSegmentStream;
+            return false;
+        }
+
+        while (pSegmentStream->GetNextFrame(*pCurFrame, false)) {
+            bool first = analysis.frameTimes.empty();
+            analysis.frameDiffs.push_back(first ? 0.0f : pCurFrame->GetDifference(pLastFrame));
+            analysis.frameContrasts.push_back(pCurFrame->GetContrast());
+            analysis.frameTimes.push_back(pSegmentStream->GetFrameTime());
+            std::swap(pCurFrame, pLastFrame);
+        }
+
+        delete pSegmentStream;
+    }
+    return true;
+}
+
+// every key frame by number, last to first, then by time
+size_t CheckKeyFrameSeeks(const Stream* pStream)
+{
+    Stream* pKeyFrameStream = pStream->Clone(1);
+    if (!pKeyFrameStream)
+        return 1;
+    pKeyFrameStream->SetKeyFramesOnly(true);
+
+    Frame               frame;
+    std::vector<double> frameTimes;
+    std::vector<float>  frameContrasts;
+    while (pKeyFrameStream->GetNextFrame(frame, false)) {
+        frameTimes.push_back(pKeyFrameStream->GetFrameTime());
+        frameContrasts.push_back(frame.GetContrast());
+    }
+
+    size_t failures = 0;
+    for (size_t i=frameTimes.size(); i-- > 0;) {
+        if (!pKeyFrameStream->SeekToFrame(i) || !pKeyFrameStream->GetNextFrame(frame, false) ||
+            std::abs(pKeyFrameStream->GetFrameTime() - frameTimes[i]) > 1e-6 || frame.GetContrast() != frameContrasts[i]) {
+            fprintf(stderr, "Key frame %zu at %.3fs not found by number\n", i, frameTimes[i]);
+            failures++;
+        }
+    }
+
+    for (size_t i=0; i<frameTimes.size(); i++) {
+        if (!pKeyFrameStream->SeekToTime(frameTimes[i]) || !pKeyFrameStream->GetNextFrame(frame, false) ||
+            std::abs(pKeyFrameStream->GetFrameTime() - frameTimes[i]) > 1e-6) {
+            fprintf(stderr, "Key frame %zu at %.3fs not found by time\n", i, frameTimes[i]);
+            failures++;
+        }
+    }
+
+    printf("%zu key frames: checked\n", frameTimes.size());
+    delete pKeyFrameStream;
+    return failures;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    std::string fileName = argc > 1 ? argv[1] : "segment_test.mp4";
+
+    av_register_all();
+
+    AVCodec* pCodec = avcodec_find_encoder(AV_CODEC_ID_MPEG4);
+    if (!pCodec) {
+        printf("No MPEG-4 encoder, nothing to check.\n");
+        return 0;
+    }
+
+    if (!WriteClip(pCodec, fileName)) {
+        fprintf(stderr, "Could not write %s.\n", fileName.c_str());
+        return 1;
+    }
+
+    Stream* pStream = Stream::Open(fileName.c_str(), 320, 200, 1);
+    if (!pStream) {
+        fprintf(stderr, "Could not open %s.\n", fileName.c_str());
+        return 1;
+    }
+
+    Analysis whole;
+    if (!Analyze(pStream, 1, whole) || whole.frameTimes.size() != FrameCount) {
+        fprintf(stderr, "One pass read %zu of %zu frames.\n", whole.frameTimes.size(), FrameCount);
+        delete pStream;
+        return 1;
+    }
+
+    size_t failures = 0;
+    for (size_t segmentCount : { 2, 3, 7 }) {
+        if (pStream->GetSegmentCount(segmentCount) != segmentCount) {
+            fprintf(stderr, "%s can't be split into %zu segments.\n", fileName.c_str(), segmentCount);
+            failures++;
+            continue;
+        }
+
+        Analysis segmented;
+        if (!Analyze(pStream, segmentCount, segmented) || segmented.frameTimes.size() != whole.frameTimes.size()) {
+            fprintf(stderr, "%zu segments: %zu frames instead of %zu\n", segmentCount, segmented.frameTimes.size(), whole.frameTimes.size());
+            failures++;
+            continue;
+        }
+
+        for (size_t i=0; i<whole.frameTimes.size(); i++) {
+            if (std::abs(segmented.frameTimes[i] - whole.frameTimes[i]) > 1e-6 ||
+                segmented.frameDiffs[i] != whole.frameDiffs[i] ||
+                segmented.frameContrasts[i] != whole.frameContrasts[i]) {
+                fprintf(stderr, "%zu segments: frame %zu at %.3fs differs\n", segmentCount, i, whole.frameTimes[i]);
+                failures++;
+                break;
+            }
+        }
+
+        printf("%zu segments: checked\n", segmentCount);
+    }
+
+    failures += CheckKeyFrameSeeks(pStream);
+
+    delete pStream;
+    remove(fileName.c_str());
+    return failures == 0 ? 0 : 1;
+}